@@ -0,0 +1,312 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+/*
+ * The kernels work on a register of elements at a time (SSE2 on x86-64, NEON on ARM) through the vector extensions of
+ * GCC and Clang, other compilers fall back to one element at a time. The elements left over after the last full
+ * register are always done one at a time.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define WLISP_VECTOR_EXTENSIONS
+#endif
+
+namespace {
+
+#ifdef WLISP_VECTOR_EXTENSIONS
+using Lanes = double __attribute__((vector_size(16)));
+using Mask = std::int64_t __attribute__((vector_size(16)));
+
+static constexpr auto lane_count = sizeof(Lanes) / sizeof(double);
+
+auto load(const double *values) noexcept -> Lanes
+{
+  auto lanes = Lanes();
+  std::memcpy(&lanes, values, sizeof(lanes));
+  return lanes;
+}
+
+auto store(double *values, const Lanes &lanes) noexcept -> void { std::memcpy(values, &lanes, sizeof(lanes)); }
+
+auto splat(const double value) noexcept -> Lanes { return Lanes() + value; }
+
+/*!
+ * \brief Returns the lanes of left where the mask is set and those of right elsewhere.
+ */
+auto select(const Mask mask, const Lanes left, const Lanes right) noexcept -> Lanes
+{
+  return (Lanes)((mask & (Mask)left) | (~mask & (Mask)right));
+}
+#endif
+
+/*!
+ * \brief What an element-wise operator does to two elements, and to two registers of them.
+ */
+template <Opcode opcode> struct Kernel;
+
+template <> struct Kernel<Opcode::add> final {
+  static auto element(const double left, const double right) noexcept -> double { return left + right; }
+#ifdef WLISP_VECTOR_EXTENSIONS
+  static auto lanes(const Lanes left, const Lanes right) noexcept -> Lanes { return left + right; }
+#endif
+};
+
+template <> struct Kernel<Opcode::subtract> final {
+  static auto element(const double left, const double right) noexcept -> double { return left - right; }
+#ifdef WLISP_VECTOR_EXTENSIONS
+  static auto lanes(const Lanes left, const Lanes right) noexcept -> Lanes { return left - right; }
+#endif
+};
+
+template <> struct Kernel<Opcode::multiply> final {
+  static auto element(const double left, const double right) noexcept -> double { return left * right; }
+#ifdef WLISP_VECTOR_EXTENSIONS
+  static auto lanes(const Lanes left, const Lanes right) noexcept -> Lanes { return left * right; }
+#endif
+};
+
+template <> struct Kernel<Opcode::divide> final {
+  static auto element(const double left, const double right) noexcept -> double { return left / right; }
+#ifdef WLISP_VECTOR_EXTENSIONS
+  static auto lanes(const Lanes left, const Lanes right) noexcept -> Lanes { return left / right; }
+#endif
+};
+
+// The comparisons give 1 where they hold and 0 where they do not.
+
+template <> struct Kernel<Opcode::less> final {
+  static auto element(const double left, const double right) noexcept -> double { return left < right ? 1.0 : 0.0; }
+#ifdef WLISP_VECTOR_EXTENSIONS
+  static auto mask(const Lanes left, const Lanes right) noexcept -> Mask { return left < right; }
+  static auto lanes(const Lanes left, const Lanes right) noexcept -> Lanes
+  {
+    return select(mask(left, right), splat(1.0), Lanes());
+  }
+#endif
+};
+
+template <> struct Kernel<Opcode::greater> final {
+  static auto element(const double left, const double right) noexcept -> double { return left > right ? 1.0 : 0.0; }
+#ifdef WLISP_VECTOR_EXTENSIONS
+  static auto mask(const Lanes left, const Lanes right) noexcept -> Mask { return left > right; }
+  static auto lanes(const Lanes left, const Lanes right) noexcept -> Lanes
+  {
+    return select(mask(left, right), splat(1.0), Lanes());
+  }
+#endif
+};
+
+template <> struct Kernel<Opcode::less_equal> final {
+  static auto element(const double left, const double right) noexcept -> double { return left <= right ? 1.0 : 0.0; }
+#ifdef WLISP_VECTOR_EXTENSIONS
+  static auto mask(const Lanes left, const Lanes right) noexcept -> Mask { return left <= right; }
+  static auto lanes(const Lanes left, const Lanes right) noexcept -> Lanes
+  {
+    return select(mask(left, right), splat(1.0), Lanes());
+  }
+#endif
+};
+
+template <> struct Kernel<Opcode::greater_equal> final {
+  static auto element(const double left, const double right) noexcept -> double { return left >= right ? 1.0 : 0.0; }
+#ifdef WLISP_VECTOR_EXTENSIONS
+  static auto mask(const Lanes left, const Lanes right) noexcept -> Mask { return left >= right; }
+  static auto lanes(const Lanes left, const Lanes right) noexcept -> Lanes
+  {
+    return select(mask(left, right), splat(1.0), Lanes());
+  }
+#endif
+};
+
+/*!
+ * \brief An array operand of an element-wise operator.
+ */
+struct Array_operand final {
+  const double *values;
+
+  auto element(const std::size_t i) const noexcept -> double { return values[i]; }
+#ifdef WLISP_VECTOR_EXTENSIONS
+  auto lanes(const std::size_t i) const noexcept -> Lanes { return load(values + i); }
+#endif
+};
+
+/*!
+ * \brief A number operand of an element-wise operator, it takes part with every element of the other.
+ */
+struct Number_operand final {
+  double value;
+
+  auto element(const std::size_t) const noexcept -> double { return value; }
+#ifdef WLISP_VECTOR_EXTENSIONS
+  auto lanes(const std::size_t) const noexcept -> Lanes { return splat(value); }
+#endif
+};
+
+template <Opcode opcode, typename Left, typename Right>
+auto element_wise_from(const Left &left, const Right &right, const std::size_t size) -> Variant
+{
+  auto result = Number_array(size);
+  const auto values = result.data();
+  auto i = std::size_t(0);
+#ifdef WLISP_VECTOR_EXTENSIONS
+  for (; i + lane_count <= size; i += lane_count) {
+    store(values + i, Kernel<opcode>::lanes(left.lanes(i), right.lanes(i)));
+  }
+#endif
+  for (; i != size; ++i) {
+    values[i] = Kernel<opcode>::element(left.element(i), right.element(i));
+  }
+  return Variant(std::move(result));
+}
+
+auto same_size(const Number_array &left, const Number_array &right) -> std::size_t
+{
+  if (left.size() != right.size()) {
+    throw std::runtime_error("Arrays are not of the same length.");
+  }
+  return left.size();
+}
+
+/*!
+ * \brief The smallest or (with a greater kernel) the largest element of a non empty array.
+ */
+template <Opcode opcode> auto extreme_from(const Variant &variant) -> Variant
+{
+  const auto &array = variant.array();
+  if (array.empty()) {
+    throw std::runtime_error("Array is empty.");
+  }
+  const auto values = array.data();
+  const auto size = array.size();
+  auto extreme = values[0];
+  auto i = std::size_t(0);
+#ifdef WLISP_VECTOR_EXTENSIONS
+  if (size >= 2 * lane_count) {
+    // Two registers of partial results, as for the sum.
+    auto extremes = load(values);
+    auto more_extremes = load(values + lane_count);
+    for (i = 2 * lane_count; i + 2 * lane_count <= size; i += 2 * lane_count) {
+      const auto lanes = load(values + i);
+      const auto more_lanes = load(values + i + lane_count);
+      extremes = select(Kernel<opcode>::mask(lanes, extremes), lanes, extremes);
+      more_extremes = select(Kernel<opcode>::mask(more_lanes, more_extremes), more_lanes, more_extremes);
+    }
+    extremes = select(Kernel<opcode>::mask(more_extremes, extremes), more_extremes, extremes);
+    for (auto lane = std::size_t(0); lane != lane_count; ++lane) {
+      extreme = Kernel<opcode>::element(extremes[lane], extreme) != 0.0 ? extremes[lane] : extreme;
+    }
+  }
+#endif
+  for (; i != size; ++i) {
+    extreme = Kernel<opcode>::element(values[i], extreme) != 0.0 ? values[i] : extreme;
+  }
+  return Variant(extreme);
+}
+
+} // namespace
+
+template <Opcode opcode> auto element_wise(const Variant &left, const Variant &right) -> Variant
+{
+  if (opcode == Opcode::divide) {
+    // Division by zero fails as it does on numbers, before anything is computed.
+    if (right.type() == Variant_type::array) {
+      const auto &divisors = right.array();
+      if (std::find(std::cbegin(divisors), std::cend(divisors), 0.0) != std::cend(divisors)) {
+        throw std::runtime_error("Divide by zero.");
+      }
+    }
+    else if (right.number() == 0.0) {
+      throw std::runtime_error("Divide by zero.");
+    }
+  }
+  if (left.type() == Variant_type::array && right.type() == Variant_type::array) {
+    const auto size = same_size(left.array(), right.array());
+    return element_wise_from<opcode>(Array_operand{left.array().data()}, Array_operand{right.array().data()}, size);
+  }
+  if (left.type() == Variant_type::array) {
+    return element_wise_from<opcode>(Array_operand{left.array().data()}, Number_operand{right.number()},
+                                     left.array().size());
+  }
+  return element_wise_from<opcode>(Number_operand{left.number()}, Array_operand{right.array().data()},
+                                   right.array().size());
+}
+
+template auto element_wise<Opcode::add>(const Variant &left, const Variant &right) -> Variant;
+template auto element_wise<Opcode::subtract>(const Variant &left, const Variant &right) -> Variant;
+template auto element_wise<Opcode::multiply>(const Variant &left, const Variant &right) -> Variant;
+template auto element_wise<Opcode::divide>(const Variant &left, const Variant &right) -> Variant;
+template auto element_wise<Opcode::less>(const Variant &left, const Variant &right) -> Variant;
+template auto element_wise<Opcode::greater>(const Variant &left, const Variant &right) -> Variant;
+template auto element_wise<Opcode::less_equal>(const Variant &left, const Variant &right) -> Variant;
+template auto element_wise<Opcode::greater_equal>(const Variant &left, const Variant &right) -> Variant;
+
+auto array_from(const Variant &variant) -> Variant
+{
+  if (variant.type() == Variant_type::array) {
+    return variant;
+  }
+  const auto &list = variant.list();
+  auto array = Number_array();
+  array.reserve(list.size());
+  for (const auto &item : list) {
+    array.emplace_back(item.number());
+  }
+  return Variant(std::move(array));
+}
+
+auto array_sum(const Variant &variant) -> Variant
+{
+  const auto &array = variant.array();
+  const auto values = array.data();
+  const auto size = array.size();
+  auto sum = 0.0;
+  auto i = std::size_t(0);
+#ifdef WLISP_VECTOR_EXTENSIONS
+  // Two registers of partial sums, so one addition does not have to wait for the one before.
+  auto sums = Lanes();
+  auto more_sums = Lanes();
+  for (; i + 2 * lane_count <= size; i += 2 * lane_count) {
+    sums += load(values + i);
+    more_sums += load(values + i + lane_count);
+  }
+  sums += more_sums;
+  for (auto lane = std::size_t(0); lane != lane_count; ++lane) {
+    sum += sums[lane];
+  }
+#endif
+  for (; i != size; ++i) {
+    sum += values[i];
+  }
+  return Variant(sum);
+}
+
+auto array_minimum(const Variant &variant) -> Variant { return extreme_from<Opcode::less>(variant); }
+
+auto array_maximum(const Variant &variant) -> Variant { return extreme_from<Opcode::greater>(variant); }
+
+auto array_dot(const Variant &left, const Variant &right) -> Variant
+{
+  const auto size = same_size(left.array(), right.array());
+  const auto left_values = left.array().data();
+  const auto right_values = right.array().data();
+  auto dot = 0.0;
+  auto i = std::size_t(0);
+#ifdef WLISP_VECTOR_EXTENSIONS
+  auto sums = Lanes();
+  auto more_sums = Lanes();
+  for (; i + 2 * lane_count <= size; i += 2 * lane_count) {
+    sums += load(left_values + i) * load(right_values + i);
+    more_sums += load(left_values + i + lane_count) * load(right_values + i + lane_count);
+  }
+  sums += more_sums;
+  for (auto lane = std::size_t(0); lane != lane_count; ++lane) {
+    dot += sums[lane];
+  }
+#endif
+  for (; i != size; ++i) {
+    dot += left_values[i] * right_values[i];
+  }
+  return Variant(dot);
+}
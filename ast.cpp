@@ -1,8 +1,110 @@
 #include "internal.hpp"
-#include <iostream>
+#include <algorithm>
+#include <stdexcept>
 
 AST_base::~AST_base() noexcept = default;
 
+/*!
+ * \brief Returns the slot of the parameter named by the given token, or no_slot when it is not a parameter. Later
+ *        parameters shadow earlier ones with the same name.
+ */
+static auto slot_from(const Token_list &parameters, const Token &token) -> std::size_t
+{
+  const auto parameter = std::find(parameters.crbegin(), parameters.crend(), token);
+  return parameter == parameters.crend() ? no_slot : static_cast<std::size_t>(parameters.crend() - parameter - 1);
+}
+
+auto resolve(const AST &ast) -> AST { return ast->resolve(Token_list()); }
+
+auto fold(const AST &ast) -> Folded
+{
+  auto removed = std::size_t(0);
+  auto folded = ast->fold(removed);
+  return Folded{std::move(folded), removed};
+}
+
+auto AST_base::tail() const -> AST { return clone(); }
+
+auto AST_base::constant() const noexcept -> const Variant * { return nullptr; }
+
+namespace {
+
+/*!
+ * \brief The function object behind a lambda. Calls the body marked as tail calls hand back to this function
+ *        (through the pending tail call) instead of nesting, and it runs them in a loop, reusing the environment.
+ */
+struct Lambda_function final {
+  Profile_name name;
+  std::shared_ptr<const Slot_names> slot_names;
+  AST body;
+
+  auto operator()(Environment environment, const Variant_list &arguments) const -> Variant;
+};
+
+/*!
+ * \brief A tail call a body made to a lambda, waiting for the Lambda_function running the body to make it.
+ */
+struct Tail_call final {
+  Variant function = Variant();
+  Variant_list arguments = Variant_list();
+  bool pending = false;
+};
+
+thread_local auto pending_tail_call = Tail_call();
+
+/*!
+ * \brief The environment of a lambda call, taken from the pool and handed back when the call ends.
+ */
+struct Pooled_environment final {
+  Pooled_environment(Environment parent, std::shared_ptr<const Slot_names> slot_names)
+      : environment(acquire_environment(std::move(parent), std::move(slot_names)))
+  {
+  }
+  ~Pooled_environment() noexcept { release_environment(std::move(environment)); }
+
+  Pooled_environment(const Pooled_environment &) = delete;
+  Pooled_environment(Pooled_environment &&) = delete;
+  Pooled_environment &operator=(const Pooled_environment &) = delete;
+  Pooled_environment &operator=(Pooled_environment &&) = delete;
+
+  Environment environment;
+};
+
+auto Lambda_function::operator()(Environment environment, const Variant_list &arguments) const -> Variant
+{
+  if (arguments.size() != slot_names->size()) {
+    throw std::runtime_error("Invalid number of arguments.");
+  }
+  // Declared first, so the lambda it holds is freed only after the frame is off the profiler's stack.
+  auto function = Variant();
+  Profile_frame profile_frame(name);
+  const Pooled_environment pooled(environment, slot_names);
+  const auto &frame = pooled.environment;
+  for (auto i = std::size_t(0), j = arguments.size(); i != j; ++i) {
+    frame->slot(i, arguments[i]);
+  }
+  auto result = body->execute(frame, arguments);
+  auto tail_arguments = Variant_list();
+  while (pending_tail_call.pending) {
+    pending_tail_call.pending = false;
+    // The callee takes over the profiler's stack entry before the lambda it replaces can be freed.
+    profile_frame.replace(pending_tail_call.function.function().target<Lambda_function>()->name);
+    function = std::move(pending_tail_call.function);
+    // Swapped rather than moved, so both lists keep their capacity for the next tail call.
+    tail_arguments.swap(pending_tail_call.arguments);
+    pending_tail_call.arguments.clear();
+    const auto &callee = *function.function().target<Lambda_function>();
+    if (tail_arguments.size() != callee.slot_names->size()) {
+      throw std::runtime_error("Invalid number of arguments.");
+    }
+    frame->rebind(callee.slot_names, tail_arguments);
+    result = callee.body->execute(frame, tail_arguments);
+  }
+  return result;
+}
+
+} // namespace
+
 struct If::Impl final {
   AST test = AST();
   AST consequent = AST();
@@ -27,63 +129,213 @@ auto If::execute(Environment environment, const Variant_list &variant_list) cons
   return impl->alternate->execute(environment, variant_list);
 }
 
+auto If::resolve(const Token_list &parameters) const -> AST
+{
+  return If(impl->test->resolve(parameters), impl->consequent->resolve(parameters),
+            impl->alternate->resolve(parameters))
+      .clone();
+}
+
+auto If::compile(Prototype &prototype) const -> void
+{
+  impl->test->compile(prototype);
+  const auto jump_to_alternate = emit(prototype, Opcode::jump_if_false);
+  impl->consequent->compile(prototype);
+  const auto jump_to_end = emit(prototype, Opcode::jump);
+  patch(prototype, jump_to_alternate);
+  impl->alternate->compile(prototype);
+  patch(prototype, jump_to_end);
+}
+
+auto If::tail() const -> AST { return If(impl->test, impl->consequent->tail(), impl->alternate->tail()).clone(); }
+
+auto If::save(Image_writer &writer) const -> void
+{
+  writer.node(Node_tag::if_);
+  writer.ast(impl->test);
+  writer.ast(impl->consequent);
+  writer.ast(impl->alternate);
+}
+
+auto If::fold(std::size_t &removed) const -> AST
+{
+  auto test = impl->test->fold(removed);
+  auto consequent = impl->consequent->fold(removed);
+  auto alternate = impl->alternate->fold(removed);
+  const auto tested = test->constant();
+  if (tested && tested->type() == Variant_type::boolean) {
+    // The if and its test go along with the branch that is never taken.
+    if (tested->boolean()) {
+      removed += 2 + alternate->size();
+      return consequent;
+    }
+    removed += 2 + consequent->size();
+    return alternate;
+  }
+  return If(test, consequent, alternate).clone();
+}
+
+auto If::size() const noexcept -> std::size_t
+{
+  return 1 + impl->test->size() + impl->consequent->size() + impl->alternate->size();
+}
+
 If::~If() noexcept = default;
 
 struct Procedure::Impl final {
   Token identifier = Token();
   AST arguments = AST();
+  std::size_t slot = no_slot;
+  bool tail_call = false;
+  char padding[7] = {0};
 };
 
-Procedure::Procedure(Token identifier, AST arguments) noexcept : impl(std::make_shared<Impl>())
+Procedure::Procedure(Token identifier, AST arguments, const std::size_t slot, const bool tail_call) noexcept
+    : impl(std::make_shared<Impl>())
 {
   impl->identifier = std::move(identifier);
   impl->arguments = std::move(arguments);
+  impl->slot = slot;
+  impl->tail_call = tail_call;
 }
 
 auto Procedure::clone() const noexcept -> AST { return std::make_shared<Procedure>(*this); }
 
 auto Procedure::execute(Environment environment, const Variant_list &variant_list) const -> Variant
 {
-  if (!environment->has(impl->identifier.value())) {
+  auto callee = Variant();
+  if (impl->slot != no_slot) {
+    callee = environment->slot(impl->slot);
+  }
+  else if (!environment->lookup(impl->identifier.symbol(), callee)) {
     throw std::runtime_error("Could not find procedure in environment.");
   }
-  return environment->get(impl->identifier.value())
-      .function()(environment, impl->arguments->execute(environment, variant_list).list());
+  const auto &function = callee.function();
+  Pooled_arguments arguments;
+  static_cast<const List &>(*impl->arguments).execute_items(environment, variant_list, arguments.values);
+  if (impl->tail_call && function.target<Lambda_function>()) {
+    pending_tail_call.function = std::move(callee);
+    pending_tail_call.arguments.swap(arguments.values);
+    pending_tail_call.pending = true;
+    return Variant();
+  }
+  return function(environment, arguments.values);
+}
+
+auto Procedure::resolve(const Token_list &parameters) const -> AST
+{
+  return Procedure(impl->identifier, impl->arguments->resolve(parameters), slot_from(parameters, impl->identifier),
+                   impl->tail_call)
+      .clone();
+}
+
+auto Procedure::tail() const -> AST { return Procedure(impl->identifier, impl->arguments, impl->slot, true).clone(); }
+
+auto Procedure::compile(Prototype &prototype) const -> void
+{
+  if (impl->slot != no_slot) {
+    emit(prototype, Opcode::load_slot, impl->slot);
+  }
+  else {
+    emit(prototype, Opcode::load_procedure, symbol_from(prototype, impl->identifier.symbol()));
+  }
+  emit(prototype, impl->tail_call ? Opcode::tail_call : Opcode::call,
+       static_cast<const List &>(*impl->arguments).compile_items(prototype));
+}
+
+auto Procedure::save(Image_writer &writer) const -> void
+{
+  writer.node(Node_tag::procedure);
+  writer.token(impl->identifier);
+  writer.slot(impl->slot);
+  writer.flag(impl->tail_call);
+  writer.ast(impl->arguments);
+}
+
+auto Procedure::fold(std::size_t &removed) const -> AST
+{
+  return Procedure(impl->identifier, impl->arguments->fold(removed), impl->slot, impl->tail_call).clone();
 }
 
+auto Procedure::size() const noexcept -> std::size_t { return 1 + impl->arguments->size(); }
+
 Procedure::~Procedure() noexcept = default;
 
 struct Lambda::Impl final {
   Token_list parameters = Token_list();
+  std::shared_ptr<const Slot_names> slot_names = nullptr;
   AST body = AST();
+  Profile_name name = nullptr;
+  bool memoized = false;
+  char padding[7] = {0};
 };
 
-Lambda::Lambda(Token_list parameters, AST body) : impl(std::make_shared<Impl>())
+Lambda::Lambda(Token_list parameters, AST body, Profile_name name, const bool memoized)
+    : impl(std::make_shared<Impl>())
 {
+  auto slot_names = Slot_names();
+  for (const auto &parameter : parameters) {
+    slot_names.emplace_back(parameter.symbol());
+  }
   impl->parameters = std::move(parameters);
+  impl->slot_names = std::make_shared<const Slot_names>(std::move(slot_names));
   impl->body = std::move(body);
+  impl->name = std::move(name);
+  impl->memoized = memoized;
 }
 
 auto Lambda::clone() const noexcept -> AST { return std::make_shared<Lambda>(*this); }
 
 auto Lambda::execute(Environment, const Variant_list &) const -> Variant
 {
-  auto parameters = impl->parameters;
-  auto body = impl->body;
-  return Variant([parameters, body](Environment environment, const Variant_list &arguments) {
-    auto new_environment = create_environment();
-    if (arguments.size() != parameters.size()) {
-      throw std::runtime_error("Invalid number of arguments.");
-    }
-    auto k = std::cbegin(arguments);
-    for (auto i = std::cbegin(parameters), j = std::cend(parameters); i != j; ++i, ++k) {
-      new_environment->set(i->value(), *k);
-    }
-    new_environment->parent(environment);
-    return body->execute(new_environment, arguments);
-  });
+  auto function = Variant(Variant_function(Lambda_function{impl->name, impl->slot_names, impl->body}));
+  return impl->memoized ? memoize(std::move(function)) : function;
+}
+
+auto Lambda::resolve(const Token_list &) const -> AST
+{
+  // The body runs in a new environment linked to the caller's, so only the lambda's own parameters have a known
+  // place; anything else is looked up by name.
+  return Lambda(impl->parameters, impl->body->resolve(impl->parameters)->tail(), impl->name,
+                impl->memoized)
+      .clone();
+}
+
+auto Lambda::compile(Prototype &prototype) const -> void
+{
+  // The function does not capture anything, so it is built once here instead of every time the lambda is evaluated.
+  emit(prototype, Opcode::constant,
+       constant_from(prototype, compile_lambda(impl->name, impl->slot_names, impl->body)));
+  if (impl->memoized) {
+    // Every evaluation of a memo-lambda has a cache of its own, as in the tree walker.
+    emit(prototype, Opcode::memoize);
+  }
+}
+
+auto Lambda::save(Image_writer &writer) const -> void
+{
+  writer.node(Node_tag::lambda);
+  writer.size(impl->parameters.size());
+  for (const auto &parameter : impl->parameters) {
+    writer.token(parameter);
+  }
+  writer.string(*impl->name);
+  writer.flag(impl->memoized);
+  writer.ast(impl->body);
+}
+
+auto Lambda::fold(std::size_t &removed) const -> AST
+{
+  return Lambda(impl->parameters, impl->body->fold(removed), impl->name, impl->memoized).clone();
+}
+
+auto Lambda::named(Profile_name name) const -> AST
+{
+  return Lambda(impl->parameters, impl->body, std::move(name), impl->memoized).clone();
 }
 
+auto Lambda::size() const noexcept -> std::size_t { return 1 + impl->body->size(); }
+
 Lambda::~Lambda() noexcept = default;
 
 struct List::Impl final {
@@ -103,56 +355,484 @@ auto List::execute(Environment environment, const Variant_list &variant_list) co
   return Variant(list);
 }
 
+auto List::execute_items(Environment environment, const Variant_list &variant_list, Variant_list &values) const
+    -> void
+{
+  for (const auto &item : impl->ast_list) {
+    values.emplace_back(item->execute(environment, variant_list));
+  }
+}
+
+auto List::resolve(const Token_list &parameters) const -> AST
+{
+  auto ast_list = AST_list();
+  for (const auto &item : impl->ast_list) {
+    ast_list.emplace_back(item->resolve(parameters));
+  }
+  return List(ast_list).clone();
+}
+
+auto List::compile(Prototype &prototype) const -> void
+{
+  emit(prototype, Opcode::make_list, compile_items(prototype));
+}
+
+auto List::compile_items(Prototype &prototype) const -> std::size_t
+{
+  for (const auto &item : impl->ast_list) {
+    item->compile(prototype);
+  }
+  return impl->ast_list.size();
+}
+
+auto List::save(Image_writer &writer) const -> void
+{
+  writer.node(Node_tag::list);
+  writer.size(impl->ast_list.size());
+  for (const auto &item : impl->ast_list) {
+    writer.ast(item);
+  }
+}
+
+auto List::fold(std::size_t &removed) const -> AST
+{
+  auto ast_list = AST_list();
+  for (const auto &item : impl->ast_list) {
+    ast_list.emplace_back(item->fold(removed));
+  }
+  return List(ast_list).clone();
+}
+
+auto List::size() const noexcept -> std::size_t
+{
+  auto size = std::size_t(1);
+  for (const auto &item : impl->ast_list) {
+    size += item->size();
+  }
+  return size;
+}
+
 List::~List() noexcept = default;
 
-struct Operator::Impl final {
+namespace {
+
+/*!
+ * \brief The work of an Operator node: what it does to two numbers, and to any other values (which are left to the
+ *        Variant operators, they throw on the types they do not take).
+ */
+template <Opcode opcode> struct Operation;
+
+template <> struct Operation<Opcode::add> final {
+  static auto numbers(const double left, const double right) noexcept -> Variant { return Variant(left + right); }
+  static auto integers(const std::int64_t left, const std::int64_t right) noexcept -> Variant
+  {
+    return integer_add(left, right);
+  }
+  static auto variants(const Variant &left, const Variant &right) -> Variant { return left + right; }
+};
+
+template <> struct Operation<Opcode::subtract> final {
+  static auto numbers(const double left, const double right) noexcept -> Variant { return Variant(left - right); }
+  static auto integers(const std::int64_t left, const std::int64_t right) noexcept -> Variant
+  {
+    return integer_subtract(left, right);
+  }
+  static auto variants(const Variant &left, const Variant &right) -> Variant { return left - right; }
+};
+
+template <> struct Operation<Opcode::multiply> final {
+  static auto numbers(const double left, const double right) noexcept -> Variant { return Variant(left * right); }
+  static auto integers(const std::int64_t left, const std::int64_t right) noexcept -> Variant
+  {
+    return integer_multiply(left, right);
+  }
+  static auto variants(const Variant &left, const Variant &right) -> Variant { return left * right; }
+};
+
+template <> struct Operation<Opcode::divide> final {
+  static auto numbers(const double left, const double right) -> Variant
+  {
+    return right == 0.0 ? Variant(left) / Variant(right) : Variant(left / right);
+  }
+  static auto integers(const std::int64_t left, const std::int64_t right) -> Variant
+  {
+    return integer_divide(left, right);
+  }
+  static auto variants(const Variant &left, const Variant &right) -> Variant { return left / right; }
+};
+
+template <> struct Operation<Opcode::less> final {
+  static auto numbers(const double left, const double right) noexcept -> Variant { return Variant(left < right); }
+  static auto integers(const std::int64_t left, const std::int64_t right) noexcept -> Variant
+  {
+    return Variant(left < right);
+  }
+  static auto variants(const Variant &left, const Variant &right) -> Variant { return left < right; }
+};
+
+template <> struct Operation<Opcode::greater> final {
+  static auto numbers(const double left, const double right) noexcept -> Variant { return Variant(left > right); }
+  static auto integers(const std::int64_t left, const std::int64_t right) noexcept -> Variant
+  {
+    return Variant(left > right);
+  }
+  static auto variants(const Variant &left, const Variant &right) -> Variant { return left > right; }
+};
+
+template <> struct Operation<Opcode::less_equal> final {
+  static auto numbers(const double left, const double right) noexcept -> Variant { return Variant(left <= right); }
+  static auto integers(const std::int64_t left, const std::int64_t right) noexcept -> Variant
+  {
+    return Variant(left <= right);
+  }
+  static auto variants(const Variant &left, const Variant &right) -> Variant { return left <= right; }
+};
+
+template <> struct Operation<Opcode::greater_equal> final {
+  static auto numbers(const double left, const double right) noexcept -> Variant { return Variant(left >= right); }
+  static auto integers(const std::int64_t left, const std::int64_t right) noexcept -> Variant
+  {
+    return Variant(left >= right);
+  }
+  static auto variants(const Variant &left, const Variant &right) -> Variant { return left >= right; }
+};
+
+template <> struct Operation<Opcode::equal> final {
+  static auto numbers(const double left, const double right) -> Variant
+  {
+    return Variant(Variant(left) == Variant(right));
+  }
+  static auto integers(const std::int64_t left, const std::int64_t right) noexcept -> Variant
+  {
+    return Variant(left == right);
+  }
+  static auto variants(const Variant &left, const Variant &right) -> Variant { return Variant(left == right); }
+};
+
+template <> struct Operation<Opcode::dot> final {
+  static auto numbers(const double left, const double right) -> Variant
+  {
+    return array_dot(Variant(left), Variant(right));
+  }
+  static auto integers(const std::int64_t left, const std::int64_t right) -> Variant
+  {
+    return array_dot(Variant(left), Variant(right));
+  }
+  static auto variants(const Variant &left, const Variant &right) -> Variant { return array_dot(left, right); }
+};
+
+/*!
+ * \brief The work of a Unary_operator node.
+ */
+template <Opcode opcode> struct Unary_operation;
+
+template <> struct Unary_operation<Opcode::make_array> final {
+  static auto variant(const Variant &operand) -> Variant { return array_from(operand); }
+};
+
+template <> struct Unary_operation<Opcode::sum> final {
+  static auto variant(const Variant &operand) -> Variant { return array_sum(operand); }
+};
+
+template <> struct Unary_operation<Opcode::minimum> final {
+  static auto variant(const Variant &operand) -> Variant { return array_minimum(operand); }
+};
+
+template <> struct Unary_operation<Opcode::maximum> final {
+  static auto variant(const Variant &operand) -> Variant { return array_maximum(operand); }
+};
+
+} // namespace
+
+auto operator_from(Token operation, AST left, AST right) -> AST
+{
+  const auto &value = operation.value();
+  if (value == "+") {
+    return Operator<Opcode::add>(std::move(operation), std::move(left), std::move(right)).clone();
+  }
+  if (value == "-") {
+    return Operator<Opcode::subtract>(std::move(operation), std::move(left), std::move(right)).clone();
+  }
+  if (value == "*") {
+    return Operator<Opcode::multiply>(std::move(operation), std::move(left), std::move(right)).clone();
+  }
+  if (value == "/") {
+    return Operator<Opcode::divide>(std::move(operation), std::move(left), std::move(right)).clone();
+  }
+  if (value == "<") {
+    return Operator<Opcode::less>(std::move(operation), std::move(left), std::move(right)).clone();
+  }
+  if (value == ">") {
+    return Operator<Opcode::greater>(std::move(operation), std::move(left), std::move(right)).clone();
+  }
+  if (value == "<=") {
+    return Operator<Opcode::less_equal>(std::move(operation), std::move(left), std::move(right)).clone();
+  }
+  if (value == ">=") {
+    return Operator<Opcode::greater_equal>(std::move(operation), std::move(left), std::move(right)).clone();
+  }
+  if (value == "=") {
+    return Operator<Opcode::equal>(std::move(operation), std::move(left), std::move(right)).clone();
+  }
+  if (value == "array-dot") {
+    return Operator<Opcode::dot>(std::move(operation), std::move(left), std::move(right)).clone();
+  }
+  throw std::runtime_error("Invalid operation.");
+}
+
+auto unary_operator_from(Token operation, AST operand) -> AST
+{
+  const auto &value = operation.value();
+  if (value == "array-from") {
+    return Unary_operator<Opcode::make_array>(std::move(operation), std::move(operand)).clone();
+  }
+  if (value == "array-sum") {
+    return Unary_operator<Opcode::sum>(std::move(operation), std::move(operand)).clone();
+  }
+  if (value == "array-min") {
+    return Unary_operator<Opcode::minimum>(std::move(operation), std::move(operand)).clone();
+  }
+  if (value == "array-max") {
+    return Unary_operator<Opcode::maximum>(std::move(operation), std::move(operand)).clone();
+  }
+  throw std::runtime_error("Invalid operation.");
+}
+
+template <Opcode opcode> struct Operator<opcode>::Impl final {
   Token operation = Token();
   AST left = AST();
   AST right = AST();
 };
 
-Operator::Operator(Token operation, AST left, AST right) : impl(std::make_shared<Impl>())
+template <Opcode opcode>
+Operator<opcode>::Operator(Token operation, AST left, AST right) : impl(std::make_shared<Impl>())
 {
   impl->operation = std::move(operation);
   impl->left = std::move(left);
   impl->right = std::move(right);
 }
 
-auto Operator::clone() const noexcept -> AST { return std::make_shared<Operator>(*this); }
+template <Opcode opcode> auto Operator<opcode>::clone() const noexcept -> AST
+{
+  return std::make_shared<Operator>(*this);
+}
 
-auto Operator::execute(Environment environment, const Variant_list &variant_list) const -> Variant
+template <Opcode opcode>
+auto Operator<opcode>::execute(Environment environment, const Variant_list &variant_list) const -> Variant
 {
-  if (impl->operation.value() == "+") {
-    return impl->left->execute(environment, variant_list) + impl->right->execute(environment, variant_list);
-  }
-  if (impl->operation.value() == "-") {
-    return impl->left->execute(environment, variant_list) - impl->right->execute(environment, variant_list);
+  const auto left = impl->left->execute(environment, variant_list);
+  const auto right = impl->right->execute(environment, variant_list);
+  if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+    return Operation<opcode>::integers(left.integer(), right.integer());
   }
-  if (impl->operation.value() == "*") {
-    return impl->left->execute(environment, variant_list) * impl->right->execute(environment, variant_list);
+  if (left.type() == Variant_type::number && right.type() == Variant_type::number) {
+    return Operation<opcode>::numbers(left.number(), right.number());
   }
-  if (impl->operation.value() == "/") {
-    return impl->left->execute(environment, variant_list) / impl->right->execute(environment, variant_list);
-  }
-  if (impl->operation.value() == "<") {
-    return impl->left->execute(environment, variant_list) < impl->right->execute(environment, variant_list);
-  }
-  if (impl->operation.value() == ">") {
-    return impl->left->execute(environment, variant_list) > impl->right->execute(environment, variant_list);
-  }
-  if (impl->operation.value() == "<=") {
-    return impl->left->execute(environment, variant_list) <= impl->right->execute(environment, variant_list);
-  }
-  if (impl->operation.value() == ">=") {
-    return impl->left->execute(environment, variant_list) >= impl->right->execute(environment, variant_list);
+  return Operation<opcode>::variants(left, right);
+}
+
+template <Opcode opcode> auto Operator<opcode>::resolve(const Token_list &parameters) const -> AST
+{
+  return Operator(impl->operation, impl->left->resolve(parameters), impl->right->resolve(parameters)).clone();
+}
+
+template <Opcode opcode> auto Operator<opcode>::compile(Prototype &prototype) const -> void
+{
+  impl->left->compile(prototype);
+  impl->right->compile(prototype);
+  emit(prototype, opcode);
+}
+
+template <Opcode opcode> auto Operator<opcode>::save(Image_writer &writer) const -> void
+{
+  // The node type is chosen again from the token by operator_from when the image is loaded.
+  writer.node(Node_tag::operator_);
+  writer.token(impl->operation);
+  writer.ast(impl->left);
+  writer.ast(impl->right);
+}
+
+template <Opcode opcode> auto Operator<opcode>::fold(std::size_t &removed) const -> AST
+{
+  auto left = impl->left->fold(removed);
+  auto right = impl->right->fold(removed);
+  if (left->constant() && right->constant()) {
+    try {
+      auto value = Operator(impl->operation, left, right).execute(nullptr, empty_variant_list);
+      removed += 2;
+      return Atomic(impl->operation, std::move(value)).clone();
+    }
+    catch (const std::runtime_error &) {
+      // Operations that fail (say a division by zero) are left to fail if and when they run.
+    }
   }
-  if (impl->operation.value() == "=") {
-    return Variant(impl->left->execute(environment, variant_list) == impl->right->execute(environment, variant_list));
+  return Operator(impl->operation, left, right).clone();
+}
+
+template <Opcode opcode> auto Operator<opcode>::size() const noexcept -> std::size_t
+{
+  return 1 + impl->left->size() + impl->right->size();
+}
+
+template <Opcode opcode> Operator<opcode>::~Operator() noexcept = default;
+
+template class Operator<Opcode::add>;
+template class Operator<Opcode::subtract>;
+template class Operator<Opcode::multiply>;
+template class Operator<Opcode::divide>;
+template class Operator<Opcode::less>;
+template class Operator<Opcode::greater>;
+template class Operator<Opcode::less_equal>;
+template class Operator<Opcode::greater_equal>;
+template class Operator<Opcode::equal>;
+template class Operator<Opcode::dot>;
+
+template <Opcode opcode> struct Unary_operator<opcode>::Impl final {
+  Token operation = Token();
+  AST operand = AST();
+};
+
+template <Opcode opcode>
+Unary_operator<opcode>::Unary_operator(Token operation, AST operand) : impl(std::make_shared<Impl>())
+{
+  impl->operation = std::move(operation);
+  impl->operand = std::move(operand);
+}
+
+template <Opcode opcode> auto Unary_operator<opcode>::clone() const noexcept -> AST
+{
+  return std::make_shared<Unary_operator>(*this);
+}
+
+template <Opcode opcode>
+auto Unary_operator<opcode>::execute(Environment environment, const Variant_list &variant_list) const -> Variant
+{
+  return Unary_operation<opcode>::variant(impl->operand->execute(environment, variant_list));
+}
+
+template <Opcode opcode> auto Unary_operator<opcode>::resolve(const Token_list &parameters) const -> AST
+{
+  return Unary_operator(impl->operation, impl->operand->resolve(parameters)).clone();
+}
+
+template <Opcode opcode> auto Unary_operator<opcode>::compile(Prototype &prototype) const -> void
+{
+  impl->operand->compile(prototype);
+  emit(prototype, opcode);
+}
+
+template <Opcode opcode> auto Unary_operator<opcode>::save(Image_writer &writer) const -> void
+{
+  writer.node(Node_tag::unary_operator);
+  writer.token(impl->operation);
+  writer.ast(impl->operand);
+}
+
+template <Opcode opcode> auto Unary_operator<opcode>::fold(std::size_t &removed) const -> AST
+{
+  auto operand = impl->operand->fold(removed);
+  const auto value = operand->constant();
+  if (value) {
+    try {
+      auto result = Unary_operation<opcode>::variant(*value);
+      removed += 1;
+      return Atomic(impl->operation, std::move(result)).clone();
+    }
+    catch (const std::runtime_error &) {
+      // As for Operator, a failing operation is left to fail when it runs.
+    }
   }
-  throw std::runtime_error("Invalid impl->operation.");
+  return Unary_operator(impl->operation, operand).clone();
+}
+
+template <Opcode opcode> auto Unary_operator<opcode>::size() const noexcept -> std::size_t
+{
+  return 1 + impl->operand->size();
+}
+
+template <Opcode opcode> Unary_operator<opcode>::~Unary_operator() noexcept = default;
+
+template class Unary_operator<Opcode::make_array>;
+template class Unary_operator<Opcode::sum>;
+template class Unary_operator<Opcode::minimum>;
+template class Unary_operator<Opcode::maximum>;
+
+struct Parallel_begin::Impl final {
+  AST thunks = AST();
+};
+
+Parallel_begin::Parallel_begin(AST thunks) : impl(std::make_shared<Impl>()) { impl->thunks = std::move(thunks); }
+
+auto Parallel_begin::clone() const noexcept -> AST { return std::make_shared<Parallel_begin>(*this); }
+
+auto Parallel_begin::execute(Environment environment, const Variant_list &variant_list) const -> Variant
+{
+  auto functions = Variant_list();
+  static_cast<const List &>(*impl->thunks).execute_items(environment, variant_list, functions);
+  return parallel_call(environment, functions);
+}
+
+auto Parallel_begin::resolve(const Token_list &parameters) const -> AST
+{
+  return Parallel_begin(impl->thunks->resolve(parameters)).clone();
+}
+
+auto Parallel_begin::compile(Prototype &prototype) const -> void
+{
+  emit(prototype, Opcode::parallel_call, static_cast<const List &>(*impl->thunks).compile_items(prototype));
+}
+
+auto Parallel_begin::save(Image_writer &writer) const -> void
+{
+  writer.node(Node_tag::parallel_begin);
+  writer.ast(impl->thunks);
+}
+
+auto Parallel_begin::fold(std::size_t &removed) const -> AST
+{
+  return Parallel_begin(impl->thunks->fold(removed)).clone();
+}
+
+auto Parallel_begin::size() const noexcept -> std::size_t { return 1 + impl->thunks->size(); }
+
+Parallel_begin::~Parallel_begin() noexcept = default;
+
+struct Future_form::Impl final {
+  AST thunk = AST();
+};
+
+Future_form::Future_form(AST thunk) : impl(std::make_shared<Impl>()) { impl->thunk = std::move(thunk); }
+
+auto Future_form::clone() const noexcept -> AST { return std::make_shared<Future_form>(*this); }
+
+auto Future_form::execute(Environment environment, const Variant_list &variant_list) const -> Variant
+{
+  auto function = impl->thunk->execute(environment, variant_list);
+  return future_from(std::move(environment), std::move(function));
+}
+
+auto Future_form::resolve(const Token_list &parameters) const -> AST
+{
+  return Future_form(impl->thunk->resolve(parameters)).clone();
 }
 
-Operator::~Operator() noexcept = default;
+auto Future_form::compile(Prototype &prototype) const -> void
+{
+  impl->thunk->compile(prototype);
+  emit(prototype, Opcode::future);
+}
+
+auto Future_form::save(Image_writer &writer) const -> void
+{
+  writer.node(Node_tag::future);
+  writer.ast(impl->thunk);
+}
+
+auto Future_form::fold(std::size_t &removed) const -> AST { return Future_form(impl->thunk->fold(removed)).clone(); }
+
+auto Future_form::size() const noexcept -> std::size_t { return 1 + impl->thunk->size(); }
+
+Future_form::~Future_form() noexcept = default;
 
 struct Print_line::Impl final {
   AST expression = AST();
@@ -164,59 +844,192 @@ auto Print_line::clone() const noexcept -> AST { return std::make_shared<Print_l
 
 auto Print_line::execute(Environment environment, const Variant_list &variant_list) const -> Variant
 {
-  std::cout << string_from(impl->expression->execute(environment, variant_list)) << std::endl;
+  const auto line = string_from(impl->expression->execute(environment, variant_list));
+  environment->output()->write(line);
   return Variant();
 }
 
+auto Print_line::resolve(const Token_list &parameters) const -> AST
+{
+  return Print_line(impl->expression->resolve(parameters)).clone();
+}
+
+auto Print_line::compile(Prototype &prototype) const -> void
+{
+  impl->expression->compile(prototype);
+  emit(prototype, Opcode::print_line);
+}
+
+auto Print_line::save(Image_writer &writer) const -> void
+{
+  writer.node(Node_tag::print_line);
+  writer.ast(impl->expression);
+}
+
+auto Print_line::fold(std::size_t &removed) const -> AST
+{
+  return Print_line(impl->expression->fold(removed)).clone();
+}
+
+auto Print_line::size() const noexcept -> std::size_t { return 1 + impl->expression->size(); }
+
 Print_line::~Print_line() noexcept = default;
 
 struct Variable::Impl final {
   Token token = Token();
+  std::size_t slot = no_slot;
 };
 
-Variable::Variable(Token token) : impl(std::make_shared<Impl>()) { impl->token = std::move(token); }
+Variable::Variable(Token token, const std::size_t slot) : impl(std::make_shared<Impl>())
+{
+  impl->token = std::move(token);
+  impl->slot = slot;
+}
 
 auto Variable::clone() const noexcept -> AST { return std::make_shared<Variable>(*this); }
 
 auto Variable::execute(Environment environment, const Variant_list &) const -> Variant
 {
-  if (!environment->has(impl->token.value())) {
+  if (impl->slot != no_slot) {
+    return environment->slot(impl->slot);
+  }
+  auto value = Variant();
+  if (!environment->lookup(impl->token.symbol(), value)) {
     throw std::runtime_error("Could not find variable in environment.");
   }
-  return environment->get(impl->token.value());
+  return value;
+}
+
+auto Variable::resolve(const Token_list &parameters) const -> AST
+{
+  return Variable(impl->token, slot_from(parameters, impl->token)).clone();
+}
+
+auto Variable::compile(Prototype &prototype) const -> void
+{
+  if (impl->slot != no_slot) {
+    emit(prototype, Opcode::load_slot, impl->slot);
+  }
+  else {
+    emit(prototype, Opcode::load_name, symbol_from(prototype, impl->token.symbol()));
+  }
 }
 
+auto Variable::save(Image_writer &writer) const -> void
+{
+  writer.node(Node_tag::variable);
+  writer.token(impl->token);
+  writer.slot(impl->slot);
+}
+
+auto Variable::fold(std::size_t &) const -> AST { return clone(); }
+
+auto Variable::size() const noexcept -> std::size_t { return 1; }
+
 Variable::~Variable() noexcept = default;
 
 struct Set::Impl final {
   Token identifier = Token();
   AST value = AST();
+  std::size_t slot = no_slot;
 };
 
-Set::Set(Token identifier, AST value) : impl(std::make_shared<Impl>())
+Set::Set(Token identifier, AST value, const std::size_t slot) : impl(std::make_shared<Impl>())
 {
   impl->identifier = std::move(identifier);
   impl->value = std::move(value);
+  impl->slot = slot;
 }
 
 auto Set::clone() const noexcept -> AST { return std::make_shared<Set>(*this); }
 
 auto Set::execute(Environment environment, const Variant_list &variant_list) const -> Variant
 {
-  environment->set(impl->identifier.value(), impl->value->execute(environment, variant_list));
+  if (impl->slot != no_slot) {
+    environment->slot(impl->slot, impl->value->execute(environment, variant_list));
+    return Variant();
+  }
+  environment->set(impl->identifier.symbol(), impl->value->execute(environment, variant_list));
   return Variant();
 }
 
+auto Set::resolve(const Token_list &parameters) const -> AST
+{
+  return Set(impl->identifier, impl->value->resolve(parameters), slot_from(parameters, impl->identifier)).clone();
+}
+
+auto Set::compile(Prototype &prototype) const -> void
+{
+  impl->value->compile(prototype);
+  if (impl->slot != no_slot) {
+    emit(prototype, Opcode::store_slot, impl->slot);
+  }
+  else {
+    emit(prototype, Opcode::store_name, symbol_from(prototype, impl->identifier.symbol()));
+  }
+}
+
+auto Set::save(Image_writer &writer) const -> void
+{
+  writer.node(Node_tag::set);
+  writer.token(impl->identifier);
+  writer.slot(impl->slot);
+  writer.ast(impl->value);
+}
+
+auto Set::fold(std::size_t &removed) const -> AST
+{
+  return Set(impl->identifier, impl->value->fold(removed), impl->slot).clone();
+}
+
+auto Set::size() const noexcept -> std::size_t { return 1 + impl->value->size(); }
+
 Set::~Set() noexcept = default;
 
 struct Atomic::Impl final {
   Token token = Token();
+  Variant value = Variant();
 };
 
-Atomic::Atomic(Token token) : impl(std::make_shared<Impl>()) { impl->token = std::move(token); }
+Atomic::Atomic(Token token) : impl(std::make_shared<Impl>())
+{
+  // The value is built once here rather than converting the token every time the literal is evaluated.
+  impl->value = variant_from(token);
+  impl->token = std::move(token);
+}
+
+Atomic::Atomic(Token token, Variant value) : impl(std::make_shared<Impl>())
+{
+  impl->token = std::move(token);
+  impl->value = std::move(value);
+}
 
 auto Atomic::clone() const noexcept -> AST { return std::make_shared<Atomic>(*this); }
 
-auto Atomic::execute(Environment, const Variant_list &) const -> Variant { return variant_from(impl->token); }
+auto Atomic::execute(Environment, const Variant_list &) const -> Variant { return impl->value; }
+
+auto Atomic::resolve(const Token_list &) const -> AST { return clone(); }
+
+auto Atomic::compile(Prototype &prototype) const -> void
+{
+  emit(prototype, Opcode::constant, constant_from(prototype, impl->value));
+}
+
+auto Atomic::save(Image_writer &writer) const -> void
+{
+  // The value is saved rather than parsed again from the token, it differs from it for a folded operation. The text of
+  // a string literal's token is only the value in quotes, it is left out so the loaded literal is not copied.
+  writer.node(Node_tag::atomic);
+  const auto &token = impl->token;
+  writer.token(token.type() == Token_type::string ? Token(token.type(), std::string(), token.line(), token.column())
+                                                   : token);
+  writer.variant(impl->value);
+}
+
+auto Atomic::fold(std::size_t &) const -> AST { return clone(); }
+
+auto Atomic::constant() const noexcept -> const Variant * { return &impl->value; }
+
+auto Atomic::size() const noexcept -> std::size_t { return 1; }
 
 Atomic::~Atomic() noexcept = default;
@@ -0,0 +1,620 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+/*
+=======================================================================================================================
+
+  Allocation counting
+
+=======================================================================================================================
+*/
+
+static std::atomic<std::size_t> allocations(0);
+
+// The replacements below pair malloc with free, GCC does not see that when it inlines them into the library.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(std::size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (const auto pointer = std::malloc(size != 0 ? size : 1)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, std::size_t) noexcept { std::free(pointer); }
+
+/*
+=======================================================================================================================
+
+  Workloads
+
+=======================================================================================================================
+*/
+
+/*!
+ * \brief The original regex driven lexer, kept as the baseline the single-pass lexer is measured against.
+ * \param input The lisp code to tokenize.
+ * \return The tokens.
+ */
+auto regex_lexical_analysis(const std::string &input) -> Token_list
+{
+  auto input_copy = input;
+  auto token_list = Token_list();
+  auto match = std::smatch();
+  auto left_parenthesis_count = 0;
+  auto right_parenthesis_count = 0;
+  for (;;) {
+    if (input_copy.empty()) {
+      break;
+    }
+    if (std::regex_search(input_copy, match, std::regex(R"(\s|\t|\n|\r)")) && match.position() == 0) {
+      input_copy = match.suffix();
+      continue;
+    }
+    if (std::regex_search(input_copy, match, std::regex(R"("(\\"|\\r|\\n|\\t|[^"])*")")) && match.position() == 0) {
+      token_list.emplace_back(Token(Token_type::string, match[0].str()));
+      input_copy = match.suffix();
+      continue;
+    }
+    if (std::regex_search(input_copy, match, std::regex(R"(-?[.]?[0-9]+[.]?[0-9]*)")) && match.position() == 0) {
+      token_list.emplace_back(Token(Token_type::number, match[0].str()));
+      input_copy = match.suffix();
+      continue;
+    }
+    if (std::regex_search(input_copy, match, std::regex(R"(#t|#f)")) && match.position() == 0) {
+      token_list.emplace_back(Token(Token_type::boolean, match[0].str()));
+      input_copy = match.suffix();
+      continue;
+    }
+    if (std::regex_search(input_copy, match, std::regex(R"(nil)")) && match.position() == 0) {
+      token_list.emplace_back(Token(Token_type::nil, match[0].str()));
+      input_copy = match.suffix();
+      continue;
+    }
+    if (std::regex_search(input_copy, match, std::regex(R"([(])")) && match.position() == 0) {
+      ++left_parenthesis_count;
+      token_list.emplace_back(Token(Token_type::left_parenthesis, match[0].str()));
+      input_copy = match.suffix();
+      continue;
+    }
+    if (std::regex_search(input_copy, match, std::regex(R"([)])")) && match.position() == 0) {
+      ++right_parenthesis_count;
+      token_list.emplace_back(Token(Token_type::right_parenthesis, match[0].str()));
+      input_copy = match.suffix();
+      continue;
+    }
+    if (std::regex_search(input_copy, match, std::regex(R"(<=|>=|<|>|=|\+|-|\*|\/)")) && match.position() == 0) {
+      token_list.emplace_back(Token(Token_type::identifier, match[0].str()));
+      input_copy = match.suffix();
+      continue;
+    }
+    if (std::regex_search(input_copy, match, std::regex(R"([a-z]+-?[a-z]+|[a-z])")) && match.position() == 0) {
+      token_list.emplace_back(Token(Token_type::identifier, match[0].str()));
+      input_copy = match.suffix();
+      continue;
+    }
+    throw std::runtime_error("Syntax error occured: " + input_copy);
+  }
+  if (left_parenthesis_count != right_parenthesis_count) {
+    throw std::runtime_error("For every '(' there must be a ')'.");
+  }
+  return token_list;
+}
+
+/*!
+ * \brief Generates a script of at least the given size out of a representative mix of forms.
+ * \param size The minimum size in bytes.
+ * \return The script.
+ */
+auto generate_script(const std::size_t size) -> std::string
+{
+  static const auto forms = std::vector<std::string>{
+      "(set fib (lambda (n) (if (<= n 1) n (+ (fib (- n 2)) (fib (- n 1))))))\n",
+      "(begin (set a 10) (set b -2.5) (print-line (* a b)))\n",
+      "(print-line \"a \\\"quoted\\\" string literal with some padding\")\n",
+      "(if (>= .5 0.25) #t #f)\n",
+      "(set is-nil (lambda (x) (= x nil)))\n",
+  };
+  auto script = std::string();
+  for (auto i = std::size_t(0); script.size() < size; ++i) {
+    script += forms[i % forms.size()];
+  }
+  return script;
+}
+
+/*!
+ * \brief Parses every top level form of the given tokens.
+ * \param token_list The tokens.
+ * \return The number of forms.
+ */
+auto parse_all(const Token_list &token_list) -> std::size_t
+{
+  auto token_cursor = cursor_from(token_list);
+  auto forms = std::size_t(0);
+  while (token_cursor.current != token_cursor.end) {
+    parse_from(token_cursor);
+    ++forms;
+  }
+  return forms;
+}
+
+/*!
+ * \brief Creates a chain of environments of the given depth with x set in the outermost one.
+ * \param depth The number of environments between the innermost one and the one holding x.
+ * \return The innermost environment.
+ */
+auto nested_environment(const std::size_t depth) -> Environment
+{
+  auto environment = create_environment();
+  environment->set("x", Variant(1.0));
+  for (auto i = std::size_t(0); i < depth; ++i) {
+    environment = create_environment(environment);
+  }
+  return environment;
+}
+
+/*!
+ * \brief Returns a begin form with the given item repeated the given number of times.
+ */
+auto repeated_begin(const std::string &item, const std::size_t count) -> std::string
+{
+  auto input = std::string("(begin");
+  for (auto i = std::size_t(0); i < count; ++i) {
+    input += " " + item;
+  }
+  return input + ")";
+}
+
+/*!
+ * \brief Returns a balanced tree of additions with the given item as its leaves.
+ */
+auto repeated_sum(const std::string &item, const std::size_t count) -> std::string
+{
+  if (count == 1) {
+    return item;
+  }
+  return "(+ " + repeated_sum(item, count / 2) + " " + repeated_sum(item, count - count / 2) + ")";
+}
+
+/*
+=======================================================================================================================
+
+  Measurement
+
+=======================================================================================================================
+*/
+
+/*!
+ * \brief The result of one benchmark. Throughput is in MB/s for workloads that consume input and in operations per
+ *        second for the others.
+ */
+struct Measurement final {
+  std::string name;
+  double nanoseconds_per_operation;
+  double allocations_per_operation;
+  double throughput;
+  std::string throughput_unit;
+  // For the scaling benchmarks, the threads run and the cores there were to run them on (0 for the others).
+  unsigned threads;
+  unsigned cores;
+};
+
+/*!
+ * \brief Runs the workload repeatedly and measures it, taking the fastest of several samples.
+ * \param name The name of the benchmark.
+ * \param operations The number of operations one run of the workload performs.
+ * \param bytes The number of input bytes one run of the workload consumes, or 0 when it does not consume input.
+ * \param workload The workload to run.
+ * \return The measurement.
+ */
+template <typename Workload>
+auto measure(const std::string &name, const std::size_t operations, const std::size_t bytes, const Workload &workload)
+    -> Measurement
+{
+  workload();
+  const auto allocations_before = allocations.load();
+  workload();
+  const auto allocated = allocations.load() - allocations_before;
+  auto best = std::chrono::duration<double>::max();
+  for (auto sample = 0; sample < 5; ++sample) {
+    auto runs = 0;
+    auto elapsed = std::chrono::duration<double>::zero();
+    const auto start = std::chrono::steady_clock::now();
+    do {
+      workload();
+      ++runs;
+      elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < 0.1);
+    best = std::min(best, elapsed / runs);
+  }
+  auto measurement = Measurement();
+  measurement.name = name;
+  measurement.nanoseconds_per_operation = best.count() * 1e9 / static_cast<double>(operations);
+  measurement.allocations_per_operation = static_cast<double>(allocated) / static_cast<double>(operations);
+  if (bytes != 0) {
+    measurement.throughput = static_cast<double>(bytes) / best.count() / (1024.0 * 1024.0);
+    measurement.throughput_unit = "MB/s";
+  }
+  else {
+    measurement.throughput = static_cast<double>(operations) / best.count();
+    measurement.throughput_unit = "op/s";
+  }
+  return measurement;
+}
+
+/*!
+ * \brief Measures a program on both engines.
+ * \param measurements The measurements to add to.
+ * \param name The name of the benchmark, the engine is appended.
+ * \param operations The number of operations one run of the program performs.
+ * \param setup Lisp code run once in the environment before measuring.
+ * \param input The lisp code to measure, compiled once.
+ * \param environment The environment to run in.
+ */
+auto measure_engines(std::vector<Measurement> &measurements, const std::string &name, const std::size_t operations,
+                     const std::string &setup, const std::string &input, Environment environment) -> void
+{
+  const auto program = compile(input);
+  for (const auto engine : {Engine::tree_walk, Engine::bytecode}) {
+    if (!setup.empty()) {
+      interpret(environment, setup, engine);
+    }
+    const auto engine_name = engine == Engine::tree_walk ? "/tree-walk" : "/bytecode";
+    measurements.emplace_back(
+        measure(name + engine_name, operations, 0,
+                [&program, &environment, engine] { program.execute(environment, engine); }));
+  }
+}
+
+/*!
+ * \brief Runs a program on the given number of threads at once for a while, each thread in an environment of its own
+ *        linked to the given shared one, and measures the combined rate.
+ * \param name The name of the benchmark.
+ * \param threads The number of threads.
+ * \param operations The number of operations one run of the program performs.
+ * \param program The program.
+ * \param shared The shared environment.
+ * \param engine The engine to run on.
+ * \return The measurement, ns/op is the wall time per operation of all threads together.
+ */
+auto measure_threads(const std::string &name, const std::size_t threads, const std::size_t operations,
+                     const Program &program, const Environment &shared, const Engine engine) -> Measurement
+{
+  std::atomic<bool> started(false);
+  std::atomic<bool> stopped(false);
+  std::atomic<std::size_t> runs(0);
+  auto workers = std::vector<std::thread>();
+  for (auto i = std::size_t(0); i < threads; ++i) {
+    workers.emplace_back([&] {
+      const auto local = create_environment(shared);
+      program.execute(local, engine);
+      while (!started) {
+        std::this_thread::yield();
+      }
+      auto local_runs = std::size_t(0);
+      for (; !stopped.load(std::memory_order_relaxed); ++local_runs) {
+        program.execute(local, engine);
+      }
+      runs += local_runs;
+    });
+  }
+  const auto allocations_before = allocations.load();
+  const auto start = std::chrono::steady_clock::now();
+  started = true;
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  stopped = true;
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+  const auto total = static_cast<double>(runs * operations);
+  auto measurement = Measurement();
+  measurement.name = name;
+  measurement.threads = static_cast<unsigned>(threads);
+  measurement.cores = std::max(std::thread::hardware_concurrency(), 1u);
+  measurement.nanoseconds_per_operation = elapsed.count() * 1e9 / total;
+  measurement.allocations_per_operation = static_cast<double>(allocations.load() - allocations_before) / total;
+  measurement.throughput = total / elapsed.count();
+  measurement.throughput_unit = "op/s";
+  return measurement;
+}
+
+/*!
+ * \brief Returns the given string quoted and escaped for JSON.
+ */
+auto json_from(const std::string &value) -> std::string
+{
+  auto json = std::string("\"");
+  for (const auto character : value) {
+    if (character == '"' || character == '\\') {
+      json += '\\';
+    }
+    json += character;
+  }
+  return json + "\"";
+}
+
+auto print_table(const std::vector<Measurement> &measurements) -> void
+{
+  std::cout << std::left << std::setw(36) << "benchmark" << std::right << std::setw(14) << "ns/op" << std::setw(14)
+            << "allocs/op" << std::setw(20) << "throughput" << std::endl;
+  for (const auto &measurement : measurements) {
+    std::cout << std::left << std::setw(36) << measurement.name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(14) << measurement.nanoseconds_per_operation << std::setprecision(2) << std::setw(14)
+              << measurement.allocations_per_operation << std::setw(15)
+              << measurement.throughput << " " << measurement.throughput_unit;
+    if (measurement.threads > measurement.cores) {
+      std::cout << "  (more threads than the " << measurement.cores << " cores observed)";
+    }
+    std::cout << std::endl;
+  }
+}
+
+auto print_json(const std::vector<Measurement> &measurements) -> void
+{
+  std::cout << "[" << std::endl;
+  for (auto i = std::size_t(0); i < measurements.size(); ++i) {
+    const auto &measurement = measurements[i];
+    std::cout << "  {\"name\": " << json_from(measurement.name)
+              << ", \"ns_per_op\": " << measurement.nanoseconds_per_operation
+              << ", \"allocations_per_op\": " << measurement.allocations_per_operation
+              << ", \"throughput\": " << measurement.throughput
+              << ", \"throughput_unit\": " << json_from(measurement.throughput_unit);
+    if (measurement.threads != 0) {
+      std::cout << ", \"threads\": " << measurement.threads << ", \"cores\": " << measurement.cores;
+    }
+    std::cout << "}"
+              << (i + 1 < measurements.size() ? "," : "") << std::endl;
+  }
+  std::cout << "]" << std::endl;
+}
+
+/*
+=======================================================================================================================
+
+  Main
+
+=======================================================================================================================
+*/
+int main(int argc, char *argv[])
+{
+  auto json = false;
+  auto filter = std::string();
+  // The scaling benchmarks run from 1 thread up to this many, whether or not there are as many cores.
+  auto expected_cores = 8u;
+  for (auto i = 1; i < argc; ++i) {
+    const auto argument = std::string(argv[i]);
+    if (argument == "--json") {
+      json = true;
+    }
+    else if (argument == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    }
+    else if (argument == "--cores" && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+      expected_cores = static_cast<unsigned>(std::atoi(argv[++i]));
+    }
+    else {
+      std::cerr << "usage: " << argv[0] << " [--json] [--filter <substring>] [--cores <count>]" << std::endl;
+      return 1;
+    }
+  }
+  const auto cores = std::max(std::thread::hardware_concurrency(), 1u);
+  if (cores < expected_cores) {
+    std::cerr << "The scaling benchmarks expect " << expected_cores << " cores, observed " << cores
+              << ": their rows with more threads than cores do not show scaling." << std::endl;
+  }
+  const auto selected = [&filter](const std::string &name) { return name.find(filter) != std::string::npos; };
+  auto measurements = std::vector<Measurement>();
+
+  for (const auto size : {std::size_t(4096), std::size_t(1048576)}) {
+    const auto input = generate_script(size);
+    const auto tokens = lexical_analysis(input);
+    const auto suffix = "/" + std::to_string(size / 1024) + "KiB";
+    // The regex lexer takes seconds on anything larger.
+    if (size <= 4096 && selected("lex/regex" + suffix)) {
+      if (regex_lexical_analysis(input) != tokens) {
+        throw std::runtime_error("Lexers disagree on the generated input.");
+      }
+      measurements.emplace_back(
+          measure("lex/regex" + suffix, tokens.size(), input.size(), [&input] { regex_lexical_analysis(input); }));
+    }
+    if (selected("lex" + suffix)) {
+      measurements.emplace_back(
+          measure("lex" + suffix, tokens.size(), input.size(), [&input] { lexical_analysis(input); }));
+    }
+    if (selected("parse" + suffix)) {
+      measurements.emplace_back(
+          measure("parse" + suffix, parse_all(tokens), input.size(), [&tokens] { parse_all(tokens); }));
+    }
+    if (selected("compile" + suffix)) {
+      const auto forms = parse_all(tokens);
+      measurements.emplace_back(
+          measure("compile" + suffix, forms, input.size(), [&input] { compile("(begin " + input + ")"); }));
+    }
+    if (selected("load" + suffix)) {
+      // The same program saved as an image, what starting from one costs instead of compiling the source.
+      const auto forms = parse_all(tokens);
+      const auto path = std::string("wlisp_bench.image");
+      compile("(begin " + input + ")").save(path);
+      measurements.emplace_back(measure("load" + suffix, forms, input.size(), [&path] { Program::load(path); }));
+      std::remove(path.c_str());
+    }
+  }
+
+  if (selected("fib")) {
+    // The recursive fibonacci from main.cpp, an operation is one call of (f n).
+    measure_engines(measurements, "fib(20)", 1,
+                    "(set f (lambda (n) (if (= n 0) 0 (if (= n 1) 1 (+ (f (- n 2)) (f (- n 1)))))))", "(f 20)",
+                    create_environment());
+  }
+
+  if (selected("fib(20)-doubles")) {
+    // The same with the literals written as doubles, what the integer arithmetic costs or saves over theirs.
+    measure_engines(measurements, "fib(20)-doubles", 1,
+                    "(set f (lambda (n) (if (= n 0.0) 0.0 (if (= n 1.0) 1.0 (+ (f (- n 2.0)) (f (- n 1.0)))))))",
+                    "(f 20.0)", create_environment());
+  }
+
+  if (selected("fib(20)-profiled")) {
+    // The same with the profiler running, to compare against the cost of calls while it is not.
+    start_profiler();
+    measure_engines(measurements, "fib(20)-profiled", 1,
+                    "(set f (lambda (n) (if (= n 0) 0 (if (= n 1) 1 (+ (f (- n 2)) (f (- n 1)))))))", "(f 20)",
+                    create_environment());
+    stop_profiler();
+  }
+
+  for (const auto depth : {std::size_t(1), std::size_t(16), std::size_t(256)}) {
+    const auto name = "lookup/depth-" + std::to_string(depth);
+    if (selected(name)) {
+      // An operation is one lookup of x through the chain.
+      measure_engines(measurements, name, 64, "", repeated_begin("x", 64), nested_environment(depth));
+    }
+  }
+
+  if (selected("closures")) {
+    // An operation is one lambda created (and passed on as an argument).
+    measure_engines(measurements, "closures", 1000,
+                    "(begin (set make (lambda (n) (if (= n 0) 0 (pass (lambda (x) (+ x n)) (- n 1))))) "
+                    "(set pass (lambda (f n) (make n))))",
+                    "(make 1000)", create_environment());
+  }
+
+  if (selected("lists")) {
+    // An operation is one 100 item list built.
+    measure_engines(measurements, "lists", 1, "(set n 1)", repeated_begin("n", 100), create_environment());
+  }
+
+  if (selected("strings")) {
+    // An operation is one string literal evaluated and compared.
+    measure_engines(measurements, "strings", 64, "",
+                    repeated_begin("(= \"a string literal of some length\" \"a string literal of some length\")", 64),
+                    create_environment());
+  }
+
+  if (selected("strings/template")) {
+    // An operation is one compile of a program of 64 copies of a 1 KiB literal, which share a single interned buffer.
+    const auto input = repeated_begin("\"" + std::string(1024, 't') + "\"", 64);
+    measurements.emplace_back(measure("strings/template", 1, input.size(), [&input] { compile(input); }));
+  }
+
+  if (selected("native")) {
+    // An operation is one call of a host function taking two numbers, registered with register_function and written
+    // by hand against Variant_list.
+    auto environment = create_environment();
+    register_function(environment, "f", [](const double left, const double right) { return left * right + 1.0; });
+    measure_engines(measurements, "native/typed", 64, "", repeated_begin("(f 3 4)", 64), environment);
+    environment = create_environment();
+    environment->set("f", Variant(Variant_function([](Environment, const Variant_list &arguments) {
+                       if (arguments.size() != 2) {
+                         throw std::runtime_error("Invalid number of arguments.");
+                       }
+                       return Variant(arguments[0].number() * arguments[1].number() + 1.0);
+                     })));
+    measure_engines(measurements, "native/variant", 64, "", repeated_begin("(f 3 4)", 64), environment);
+  }
+
+  if (selected("print-line")) {
+    // An operation is one line printed to a file, flushed after every line (as print-line used to) and in batches,
+    // and one line handed to a sink that drops it (the cost of print-line itself).
+    struct Discarding_output final : Output_sink {
+      auto write(const std::string &) -> void {}
+    };
+    const auto path = std::string("wlisp_bench.output");
+    const auto input = repeated_begin("(print-line \"a line of log output of some typical length\")", 64);
+    {
+      auto file = std::ofstream(path, std::ios::trunc);
+      const auto environment = create_environment();
+      environment->output(std::make_shared<Buffered_output>(file, Output_options{0, Flush_policy::every_line}));
+      measure_engines(measurements, "print-line/every-line", 64, "", input, environment);
+      environment->output(std::make_shared<Buffered_output>(file, Output_options{65536, Flush_policy::when_full}));
+      measure_engines(measurements, "print-line/when-full", 64, "", input, environment);
+      environment->output(std::make_shared<Discarding_output>());
+      measure_engines(measurements, "print-line/discard", 64, "", input, environment);
+    }
+    std::remove(path.c_str());
+  }
+
+  if (selected("arrays")) {
+    // An operation is one element of the 100000 element arrays x and y.
+    const auto size = std::size_t(100000);
+    auto x = Number_array(size);
+    auto y = Number_array(size);
+    for (auto i = std::size_t(0); i < size; ++i) {
+      x[i] = static_cast<double>(i % 1000) / 1000.0;
+      y[i] = static_cast<double>((i * 7) % 1000) / 1000.0;
+    }
+    const auto environment = create_environment();
+    environment->set("x", Variant(std::move(x)));
+    environment->set("y", Variant(std::move(y)));
+    measure_engines(measurements, "arrays/add", size, "", "(+ x y)", environment);
+    measure_engines(measurements, "arrays/less", size, "", "(< x y)", environment);
+    measure_engines(measurements, "arrays/sum", size, "", "(array-sum x)", environment);
+    measure_engines(measurements, "arrays/max", size, "", "(array-max x)", environment);
+    measure_engines(measurements, "arrays/dot", size, "", "(array-dot x y)", environment);
+    measure_engines(measurements, "arrays/score", size, "", "(array-sum (* (- x 0.5) y))", environment);
+  }
+
+  if (selected("concurrent-lookup")) {
+    // An operation is one lookup of x in a concurrent environment shared by all threads, from 1 thread up to the
+    // expected cores.
+    const auto shared = create_concurrent_environment();
+    shared->set("x", Variant(1.0));
+    const auto program = compile(repeated_sum("x", 64));
+    for (auto threads = 1u;; threads = std::min(threads * 2, expected_cores)) {
+      for (const auto engine : {Engine::tree_walk, Engine::bytecode}) {
+        const auto engine_name = engine == Engine::tree_walk ? "/tree-walk" : "/bytecode";
+        measurements.emplace_back(measure_threads("concurrent-lookup/threads-" + std::to_string(threads) + engine_name,
+                                                  threads, 64, program, shared, engine));
+      }
+      if (threads == expected_cores) {
+        break;
+      }
+    }
+  }
+
+  if (selected("pmap")) {
+    // An operation is one of the eight (f 16) calls mapped in parallel, from 1 thread up to the expected cores.
+    for (auto threads = 1u;; threads = std::min(threads * 2, expected_cores)) {
+      set_thread_pool_size(threads);
+      measure_engines(measurements, "pmap/threads-" + std::to_string(threads), 8,
+                      "(set f (lambda (n) (if (= n 0) 0 (if (= n 1) 1 (+ (f (- n 2)) (f (- n 1)))))))",
+                      "(pmap f (begin 16 16 16 16 16 16 16 16))", create_environment());
+      for (auto i = measurements.size() - 2; i != measurements.size(); ++i) {
+        measurements[i].threads = threads;
+        measurements[i].cores = cores;
+      }
+      if (threads == expected_cores) {
+        break;
+      }
+    }
+    set_thread_pool_size(cores);
+  }
+
+  if (json) {
+    print_json(measurements);
+  }
+  else {
+    print_table(measurements);
+  }
+  return 0;
+}
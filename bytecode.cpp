@@ -0,0 +1,649 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <stdexcept>
+
+/*
+ * The computed goto dispatch (a jump table of label addresses) is a GCC/Clang extension, other compilers fall back
+ * to a switch in a loop.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define WLISP_COMPUTED_GOTO
+#endif
+
+namespace {
+
+/*!
+ * \brief A call in progress. The arguments of the call are the slots of the frame and live on the value stack
+ *        starting at base, until something needs the frame as an Environment (a call into host code, or a set of a
+ *        new variable), then they are moved into a materialized environment. The function being called sits just
+ *        below the slots, keeping the prototype alive. A frame is profiled when the profiler was running when the
+ *        call started, and it then has an entry on the shadow stack.
+ */
+struct Frame final {
+  const Prototype *prototype;
+  const Instruction *return_address;
+  std::size_t base;
+  Environment environment;
+  bool profiled;
+  char padding[7];
+};
+
+/*!
+ * \brief Takes the entries of the frames of a run that ends with an exception off the shadow stack. Only frames that
+ *        are profiled have one, so while the profiler is off this never touches the profiler's state.
+ */
+class Profile_guard final {
+public:
+  explicit Profile_guard(const std::vector<Frame> &frames) noexcept : frames(frames) {}
+  ~Profile_guard() noexcept
+  {
+    for (const auto &frame : frames) {
+      if (frame.profiled) {
+        pop_profile_frame();
+      }
+    }
+  }
+
+  Profile_guard(const Profile_guard &) = delete;
+  Profile_guard(Profile_guard &&) = delete;
+  Profile_guard &operator=(const Profile_guard &) = delete;
+  Profile_guard &operator=(Profile_guard &&) = delete;
+
+private:
+  const std::vector<Frame> &frames;
+};
+
+/*!
+ * \brief Counts, per hash bucket, the names bound by the frames whose slots are still on the stack. When the bucket
+ *        of a name is empty none of those frames binds it, and looking it up can go straight to the environments.
+ */
+class Slot_filter final {
+public:
+  auto add(const Slot_names &slot_names) noexcept -> void
+  {
+    for (const auto &slot_name : slot_names) {
+      ++counts[bucket_from(slot_name)];
+    }
+  }
+
+  auto remove(const Slot_names &slot_names) noexcept -> void
+  {
+    for (const auto &slot_name : slot_names) {
+      --counts[bucket_from(slot_name)];
+    }
+  }
+
+  auto may_bind(const Symbol &symbol) const noexcept -> bool { return counts[bucket_from(symbol)] != 0; }
+
+private:
+  static auto bucket_from(const Symbol &symbol) noexcept -> std::size_t
+  {
+    return (std::hash<Symbol>()(symbol) >> 4) % std::tuple_size<decltype(counts)>::value;
+  }
+
+  std::array<std::uint32_t, 64> counts = {};
+};
+
+/*!
+ * \brief The function object behind a compiled lambda. The machine recognizes it and calls it in place, everyone
+ *        else calls it through the Variant_function like any other function.
+ */
+struct Compiled_lambda final {
+  std::shared_ptr<const Prototype> prototype;
+
+  auto operator()(Environment environment, const Variant_list &arguments) const -> Variant
+  {
+    return run(*prototype, std::move(environment), arguments);
+  }
+};
+
+} // namespace
+
+auto emit(Prototype &prototype, const Opcode opcode, const std::size_t operand) -> std::size_t
+{
+  prototype.code.emplace_back(Instruction{opcode, static_cast<std::uint32_t>(operand)});
+  return prototype.code.size() - 1;
+}
+
+auto patch(Prototype &prototype, const std::size_t instruction) -> void
+{
+  prototype.code[instruction].operand = static_cast<std::uint32_t>(prototype.code.size());
+}
+
+auto constant_from(Prototype &prototype, Variant constant) -> std::size_t
+{
+  prototype.constants.emplace_back(std::move(constant));
+  return prototype.constants.size() - 1;
+}
+
+auto symbol_from(Prototype &prototype, const Symbol &symbol) -> std::size_t
+{
+  for (auto i = std::size_t(0), j = prototype.symbols.size(); i != j; ++i) {
+    if (prototype.symbols[i] == symbol) {
+      return i;
+    }
+  }
+  prototype.symbols.emplace_back(symbol);
+  return prototype.symbols.size() - 1;
+}
+
+auto compile_lambda(const Profile_name &name, std::shared_ptr<const Slot_names> slot_names, const AST &body)
+    -> Variant
+{
+  auto prototype = std::make_shared<Prototype>();
+  prototype->slot_names = std::move(slot_names);
+  prototype->name = name;
+  body->compile(*prototype);
+  emit(*prototype, Opcode::return_);
+  return Variant(Variant_function(Compiled_lambda{prototype}));
+}
+
+auto compile(const AST &ast) -> std::shared_ptr<const Prototype>
+{
+  auto prototype = std::make_shared<Prototype>();
+  ast->compile(*prototype);
+  emit(*prototype, Opcode::return_);
+  return prototype;
+}
+
+/*
+ * A computed goto leaves the block of an instruction without running the destructors of its locals, so no local that
+ * owns anything (a Variant, a list) may be alive at WLISP_NEXT. Instructions work on the stack in place, and values
+ * they only pass on are temporaries of a single full-expression.
+ */
+#ifdef WLISP_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define WLISP_CASE(opcode) label_##opcode:
+#define WLISP_NEXT()                                                                                                   \
+  do {                                                                                                                 \
+    instruction = ip++;                                                                                                \
+    goto *labels[static_cast<std::size_t>(instruction->opcode)];                                                       \
+  } while (false)
+#else
+#define WLISP_CASE(opcode) case Opcode::opcode:
+#define WLISP_NEXT() continue
+#endif
+
+auto run(const Prototype &prototype, Environment environment, const Variant_list &arguments) -> Variant
+{
+  auto stack = Variant_list();
+  auto frames = std::vector<Frame>();
+  auto slot_filter = Slot_filter();
+  auto materialized = std::size_t(0);
+  const Profile_guard profile_guard(frames);
+  stack.reserve(64);
+  frames.reserve(16);
+  if (prototype.slot_names) {
+    if (arguments.size() != prototype.slot_names->size()) {
+      throw std::runtime_error("Invalid number of arguments.");
+    }
+    stack.emplace_back();
+    stack.insert(std::end(stack), std::cbegin(arguments), std::cend(arguments));
+    const auto profiled = profiler_running.load(std::memory_order_relaxed);
+    if (profiled) {
+      push_profile_frame(*prototype.name);
+    }
+    frames.emplace_back(Frame{&prototype, nullptr, 1, nullptr, profiled, {}});
+    slot_filter.add(*prototype.slot_names);
+  }
+  else {
+    frames.emplace_back(Frame{&prototype, nullptr, 0, environment, false, {}});
+    materialized = 1;
+  }
+
+  // Gives every frame that does not have one yet an environment, linked the same way the tree walker links lambda
+  // environments (to the caller's), and returns the environment of the current frame. Frames only ever get an
+  // environment from the bottom up, so the first materialized frames are the ones that have one.
+  const auto materialize = [&]() -> const Environment & {
+    for (auto j = frames.size(); materialized != j; ++materialized) {
+      auto &frame = frames[materialized];
+      const auto &slot_names = frame.prototype->slot_names;
+      frame.environment =
+          acquire_environment(materialized == 0 ? environment : frames[materialized - 1].environment, slot_names);
+      for (auto i = std::size_t(0), j = slot_names->size(); i != j; ++i) {
+        frame.environment->slot(i, std::move(stack[frame.base + i]));
+      }
+      slot_filter.remove(*slot_names);
+    }
+    return frames.back().environment;
+  };
+
+  // Finds the slot still on the stack that binds the name, if any, searching the frames from the current one down.
+  const auto find_slot = [&](const Symbol &symbol) -> Variant * {
+    if (!slot_filter.may_bind(symbol)) {
+      return nullptr;
+    }
+    for (auto i = frames.size(); i-- > materialized;) {
+      const auto &frame = frames[i];
+      const auto &slot_names = *frame.prototype->slot_names;
+      for (auto j = slot_names.size(); j-- > 0;) {
+        if (slot_names[j] == symbol) {
+          return &stack[frame.base + j];
+        }
+      }
+    }
+    return nullptr;
+  };
+
+  // The environment the remaining lookup continues in after the frames on the stack.
+  const auto outer_environment = [&]() -> const Environment & {
+    return materialized == 0 ? environment : frames[materialized - 1].environment;
+  };
+
+  // Looks a name up through the frames the same way Environment_base does through environments, and copies its value.
+  const auto lookup = [&](const Symbol &symbol, Variant &value) -> bool {
+    const auto slot = find_slot(symbol);
+    if (slot) {
+      value = *slot;
+      return true;
+    }
+    return outer_environment()->lookup(symbol, value);
+  };
+
+  // Calls a function that is not a compiled lambda (host code or a tree walker lambda) with the arguments from base to
+  // the top of the stack, and replaces the function and its arguments with the result.
+  const auto call_function = [&](const std::size_t base) {
+    const auto first = std::next(std::begin(stack), static_cast<std::ptrdiff_t>(base));
+    Pooled_arguments call_arguments;
+    call_arguments.values.assign(std::make_move_iterator(first), std::make_move_iterator(std::end(stack)));
+    auto result = stack[base - 1].function()(materialize(), call_arguments.values);
+    stack.resize(base - 1);
+    stack.emplace_back(std::move(result));
+  };
+
+  // Removes the count values just below the top of the stack, which an instruction has moved into its result.
+  const auto drop_below_top = [&](const std::size_t count) {
+    stack.erase(std::prev(std::end(stack), static_cast<std::ptrdiff_t>(count + 1)), std::prev(std::end(stack)));
+  };
+
+  auto current = &prototype;
+  auto ip = prototype.code.data();
+  auto instruction = ip;
+
+#ifdef WLISP_COMPUTED_GOTO
+  static void *const labels[] = {
+      &&label_constant,      &&label_load_slot,     &&label_load_name,    &&label_load_procedure,
+      &&label_store_slot,    &&label_store_name,    &&label_jump,         &&label_jump_if_false,
+      &&label_make_list,     &&label_add,           &&label_subtract,     &&label_multiply,
+      &&label_divide,        &&label_less,          &&label_greater,      &&label_less_equal,
+      &&label_greater_equal, &&label_equal,         &&label_dot,          &&label_make_array,
+      &&label_sum,           &&label_minimum,       &&label_maximum,      &&label_print_line,
+      &&label_memoize,       &&label_parallel_call, &&label_future,       &&label_call,
+      &&label_tail_call,     &&label_return_};
+  static_assert(sizeof(labels) / sizeof(labels[0]) == static_cast<std::size_t>(Opcode::return_) + 1,
+                "Every opcode needs a label.");
+  WLISP_NEXT();
+#else
+  for (;;) {
+    instruction = ip++;
+    switch (instruction->opcode) {
+#endif
+
+  WLISP_CASE(constant)
+  {
+    stack.emplace_back(current->constants[instruction->operand]);
+    WLISP_NEXT();
+  }
+  WLISP_CASE(load_slot)
+  {
+    const auto &frame = frames.back();
+    stack.emplace_back();
+    stack.back() = frame.environment ? frame.environment->slot(instruction->operand)
+                                     : stack[frame.base + instruction->operand];
+    WLISP_NEXT();
+  }
+  WLISP_CASE(load_name)
+  {
+    stack.emplace_back();
+    if (!lookup(current->symbols[instruction->operand], stack.back())) {
+      throw std::runtime_error("Could not find variable in environment.");
+    }
+    WLISP_NEXT();
+  }
+  WLISP_CASE(load_procedure)
+  {
+    stack.emplace_back();
+    if (!lookup(current->symbols[instruction->operand], stack.back())) {
+      throw std::runtime_error("Could not find procedure in environment.");
+    }
+    WLISP_NEXT();
+  }
+  WLISP_CASE(store_slot)
+  {
+    const auto &frame = frames.back();
+    if (frame.environment) {
+      frame.environment->slot(instruction->operand, std::move(stack.back()));
+    }
+    else {
+      stack[frame.base + instruction->operand] = std::move(stack.back());
+    }
+    stack.back() = Variant();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(store_name)
+  {
+    // An existing variable is overwritten where it is found, a new one is created in the current frame.
+    const auto &symbol = current->symbols[instruction->operand];
+    const auto slot = find_slot(symbol);
+    if (slot) {
+      *slot = std::move(stack.back());
+    }
+    else if (outer_environment()->has(symbol)) {
+      outer_environment()->set(symbol, std::move(stack.back()));
+    }
+    else {
+      materialize()->set(symbol, std::move(stack.back()));
+    }
+    stack.back() = Variant();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(jump)
+  {
+    ip = current->code.data() + instruction->operand;
+    WLISP_NEXT();
+  }
+  WLISP_CASE(jump_if_false)
+  {
+    const auto tested = stack.back().boolean();
+    stack.pop_back();
+    if (!tested) {
+      ip = current->code.data() + instruction->operand;
+    }
+    WLISP_NEXT();
+  }
+  WLISP_CASE(make_list)
+  {
+    const auto first = std::prev(std::end(stack), static_cast<std::ptrdiff_t>(instruction->operand));
+    stack.emplace_back(Variant_list(std::make_move_iterator(first), std::make_move_iterator(std::end(stack))));
+    drop_below_top(instruction->operand);
+    WLISP_NEXT();
+  }
+  WLISP_CASE(add)
+  {
+    auto &left = stack[stack.size() - 2];
+    const auto &right = stack.back();
+    if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+      left = integer_add(left.integer(), right.integer());
+    }
+    else if (left.type() == Variant_type::number && right.type() == Variant_type::number) {
+      left = Variant(left.number() + right.number());
+    }
+    else {
+      left = left + right;
+    }
+    stack.pop_back();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(subtract)
+  {
+    auto &left = stack[stack.size() - 2];
+    const auto &right = stack.back();
+    if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+      left = integer_subtract(left.integer(), right.integer());
+    }
+    else if (left.type() == Variant_type::number && right.type() == Variant_type::number) {
+      left = Variant(left.number() - right.number());
+    }
+    else {
+      left = left - right;
+    }
+    stack.pop_back();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(multiply)
+  {
+    auto &left = stack[stack.size() - 2];
+    const auto &right = stack.back();
+    if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+      left = integer_multiply(left.integer(), right.integer());
+    }
+    else if (left.type() == Variant_type::number && right.type() == Variant_type::number) {
+      left = Variant(left.number() * right.number());
+    }
+    else {
+      left = left * right;
+    }
+    stack.pop_back();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(divide)
+  {
+    auto &left = stack[stack.size() - 2];
+    left = left / stack.back();
+    stack.pop_back();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(less)
+  {
+    auto &left = stack[stack.size() - 2];
+    const auto &right = stack.back();
+    if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+      left = Variant(left.integer() < right.integer());
+    }
+    else if (left.type() == Variant_type::number && right.type() == Variant_type::number) {
+      left = Variant(left.number() < right.number());
+    }
+    else {
+      left = left < right;
+    }
+    stack.pop_back();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(greater)
+  {
+    auto &left = stack[stack.size() - 2];
+    const auto &right = stack.back();
+    if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+      left = Variant(left.integer() > right.integer());
+    }
+    else if (left.type() == Variant_type::number && right.type() == Variant_type::number) {
+      left = Variant(left.number() > right.number());
+    }
+    else {
+      left = left > right;
+    }
+    stack.pop_back();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(less_equal)
+  {
+    auto &left = stack[stack.size() - 2];
+    const auto &right = stack.back();
+    if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+      left = Variant(left.integer() <= right.integer());
+    }
+    else if (left.type() == Variant_type::number && right.type() == Variant_type::number) {
+      left = Variant(left.number() <= right.number());
+    }
+    else {
+      left = left <= right;
+    }
+    stack.pop_back();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(greater_equal)
+  {
+    auto &left = stack[stack.size() - 2];
+    const auto &right = stack.back();
+    if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+      left = Variant(left.integer() >= right.integer());
+    }
+    else if (left.type() == Variant_type::number && right.type() == Variant_type::number) {
+      left = Variant(left.number() >= right.number());
+    }
+    else {
+      left = left >= right;
+    }
+    stack.pop_back();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(equal)
+  {
+    auto &left = stack[stack.size() - 2];
+    left = Variant(left == stack.back());
+    stack.pop_back();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(dot)
+  {
+    auto &left = stack[stack.size() - 2];
+    left = array_dot(left, stack.back());
+    stack.pop_back();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(make_array)
+  {
+    stack.back() = array_from(stack.back());
+    WLISP_NEXT();
+  }
+  WLISP_CASE(sum)
+  {
+    stack.back() = array_sum(stack.back());
+    WLISP_NEXT();
+  }
+  WLISP_CASE(minimum)
+  {
+    stack.back() = array_minimum(stack.back());
+    WLISP_NEXT();
+  }
+  WLISP_CASE(maximum)
+  {
+    stack.back() = array_maximum(stack.back());
+    WLISP_NEXT();
+  }
+  WLISP_CASE(print_line)
+  {
+    outer_environment()->output()->write(string_from(stack.back()));
+    stack.back() = Variant();
+    WLISP_NEXT();
+  }
+  WLISP_CASE(memoize)
+  {
+    stack.back() = memoize(std::move(stack.back()));
+    WLISP_NEXT();
+  }
+  WLISP_CASE(parallel_call)
+  {
+    // The functions run on other threads, with the current frame's environment as the caller's.
+    const auto first = std::prev(std::end(stack), static_cast<std::ptrdiff_t>(instruction->operand));
+    stack.emplace_back(parallel_call(
+        materialize(), Variant_list(std::make_move_iterator(first), std::make_move_iterator(std::end(stack)))));
+    drop_below_top(instruction->operand);
+    WLISP_NEXT();
+  }
+  WLISP_CASE(future)
+  {
+    stack.back() = future_from(materialize(), std::move(stack.back()));
+    WLISP_NEXT();
+  }
+  WLISP_CASE(tail_call)
+  {
+    const auto base = stack.size() - instruction->operand;
+    const auto compiled_lambda = stack[base - 1].function().target<Compiled_lambda>();
+    if (compiled_lambda) {
+      // The current frame is reused for the callee. If the callee's parameters shadow all of the current ones the
+      // callee and its arguments simply replace the current call on the stack, otherwise the current slots are
+      // rebound in its environment, which keeps the values the callee can still see by name.
+      auto &frame = frames.back();
+      const auto callee = compiled_lambda->prototype.get();
+      const auto &slot_names = *frame.prototype->slot_names;
+      const auto &callee_slot_names = *callee->slot_names;
+      if (instruction->operand != callee_slot_names.size()) {
+        throw std::runtime_error("Invalid number of arguments.");
+      }
+      // The callee takes over the profiler's stack entry before the lambda it replaces can be freed.
+      if (frame.profiled) {
+        replace_profile_frame(*callee->name);
+      }
+      const auto shadowed = std::all_of(std::cbegin(slot_names), std::cend(slot_names), [&](const Symbol &symbol) {
+        return std::find(std::cbegin(callee_slot_names), std::cend(callee_slot_names), symbol) !=
+               std::cend(callee_slot_names);
+      });
+      if (!frame.environment && shadowed) {
+        slot_filter.remove(slot_names);
+        std::move(std::next(std::begin(stack), static_cast<std::ptrdiff_t>(base - 1)), std::end(stack),
+                  std::next(std::begin(stack), static_cast<std::ptrdiff_t>(frame.base - 1)));
+        slot_filter.add(callee_slot_names);
+      }
+      else {
+        const auto first = std::next(std::begin(stack), static_cast<std::ptrdiff_t>(base));
+        materialize()->rebind(callee->slot_names,
+                              Variant_list(std::make_move_iterator(first), std::make_move_iterator(std::end(stack))));
+        stack[frame.base - 1] = std::move(stack[base - 1]);
+      }
+      stack.resize(frame.base + instruction->operand);
+      frame.prototype = callee;
+      current = callee;
+      ip = callee->code.data();
+      WLISP_NEXT();
+    }
+    call_function(base);
+    WLISP_NEXT();
+  }
+  WLISP_CASE(call)
+  {
+    const auto base = stack.size() - instruction->operand;
+    const auto &function = stack[base - 1].function();
+    const auto compiled_lambda = function.target<Compiled_lambda>();
+    if (compiled_lambda) {
+      // The callee stays on the stack below the frame for the duration of the call, keeping the prototype alive.
+      const auto callee = compiled_lambda->prototype.get();
+      if (instruction->operand != callee->slot_names->size()) {
+        throw std::runtime_error("Invalid number of arguments.");
+      }
+      const auto profiled = profiler_running.load(std::memory_order_relaxed);
+      if (profiled) {
+        push_profile_frame(*callee->name);
+      }
+      frames.emplace_back(Frame{callee, ip, base, nullptr, profiled, {}});
+      slot_filter.add(*callee->slot_names);
+      current = callee;
+      ip = callee->code.data();
+      WLISP_NEXT();
+    }
+    call_function(base);
+    WLISP_NEXT();
+  }
+  WLISP_CASE(return_)
+  {
+    auto &frame = frames.back();
+    if (frame.profiled) {
+      pop_profile_frame();
+      frame.profiled = false;
+    }
+    if (frames.size() == 1) {
+      auto result = std::move(stack.back());
+      if (frame.environment && frame.prototype->slot_names) {
+        release_environment(std::move(frame.environment));
+      }
+      return result;
+    }
+    stack[frame.base - 1] = std::move(stack.back());
+    stack.resize(frame.base);
+    ip = frame.return_address;
+    if (frame.environment) {
+      --materialized;
+      release_environment(std::move(frame.environment));
+    }
+    else {
+      slot_filter.remove(*frame.prototype->slot_names);
+    }
+    frames.pop_back();
+    current = frames.back().prototype;
+    WLISP_NEXT();
+  }
+
+#ifndef WLISP_COMPUTED_GOTO
+    }
+  }
+#endif
+}
+
+#undef WLISP_CASE
+#undef WLISP_NEXT
+#ifdef WLISP_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
@@ -1,67 +1,291 @@
-#include "wlisp.hpp"
+#include "internal.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
 #include <sstream>
+#include <stdexcept>
 #include <unordered_map>
 
+/*!
+ * \brief The lock of a concurrent environment. Readers lock the stripe of their thread, writers lock every stripe, so
+ *        readers on different threads never touch the same mutex (or cache line).
+ */
+struct Environment_base::Locks final {
+  struct alignas(64) Stripe final {
+    std::mutex mutex;
+  };
+
+  std::array<Stripe, 16> stripes;
+
+  // Plain new only aligns to std::max_align_t before C++17, so the block is over-allocated and the stripes placed on
+  // a cache line boundary within it, with the start of the block stored just before them.
+  static auto operator new(const std::size_t size) -> void *
+  {
+    static_assert(alignof(std::max_align_t) >= sizeof(char *), "No room to store the block before the stripes.");
+    const auto block = static_cast<char *>(::operator new(size + alignof(Locks)));
+    const auto aligned = block + alignof(Locks) - reinterpret_cast<std::uintptr_t>(block) % alignof(Locks);
+    std::memcpy(aligned - sizeof(block), &block, sizeof(block));
+    return aligned;
+  }
+
+  static auto operator delete(void *pointer) noexcept -> void
+  {
+    auto block = static_cast<char *>(nullptr);
+    std::memcpy(&block, static_cast<char *>(pointer) - sizeof(block), sizeof(block));
+    ::operator delete(block);
+  }
+
+  auto reader() -> std::mutex &
+  {
+    static std::atomic<std::size_t> next_stripe(0);
+    thread_local const auto stripe = next_stripe++ % std::tuple_size<decltype(stripes)>::value;
+    return stripes[stripe].mutex;
+  }
+
+  auto lock() -> void
+  {
+    for (auto &stripe : stripes) {
+      stripe.mutex.lock();
+    }
+  }
+
+  auto unlock() noexcept -> void
+  {
+    for (auto &stripe : stripes) {
+      stripe.mutex.unlock();
+    }
+  }
+};
+
 struct Environment_base::Impl final {
-  std::unordered_map<std::string, Variant> map = std::unordered_map<std::string, Variant>();
+  std::unordered_map<Symbol, Variant> map = std::unordered_map<Symbol, Variant>();
   Environment parent = nullptr;
+  std::shared_ptr<const Slot_names> slot_names = nullptr;
+  Variant_list slots = Variant_list();
+  std::unique_ptr<Locks> locks = nullptr;
+  Output output = nullptr;
+};
+
+namespace {
+
+/*!
+ * \brief Holds the read lock of a concurrent environment, does nothing for any other.
+ */
+template <typename Locks> class Read_lock final {
+public:
+  explicit Read_lock(Locks *locks) : mutex(locks ? &locks->reader() : nullptr)
+  {
+    if (mutex) {
+      mutex->lock();
+    }
+  }
+  ~Read_lock() noexcept
+  {
+    if (mutex) {
+      mutex->unlock();
+    }
+  }
+
+  Read_lock(const Read_lock &) = delete;
+  Read_lock(Read_lock &&) = delete;
+  Read_lock &operator=(const Read_lock &) = delete;
+  Read_lock &operator=(Read_lock &&) = delete;
+
+private:
+  std::mutex *mutex;
+};
+
+/*!
+ * \brief Holds the write lock of a concurrent environment, does nothing for any other.
+ */
+template <typename Locks> class Write_lock final {
+public:
+  explicit Write_lock(Locks *locks) : locks(locks)
+  {
+    if (locks) {
+      locks->lock();
+    }
+  }
+  ~Write_lock() noexcept
+  {
+    if (locks) {
+      locks->unlock();
+    }
+  }
+
+  Write_lock(const Write_lock &) = delete;
+  Write_lock(Write_lock &&) = delete;
+  Write_lock &operator=(const Write_lock &) = delete;
+  Write_lock &operator=(Write_lock &&) = delete;
+
+private:
+  Locks *locks;
 };
 
+} // namespace
+
 Environment_base::Environment_base() noexcept : impl(std::make_shared<Impl>()) {}
 
 Environment_base::Environment_base(Environment parent) noexcept : Environment_base() { impl->parent = parent; }
 
+Environment_base::Environment_base(Environment parent, std::shared_ptr<const Slot_names> slot_names,
+                                   Variant_list slots) noexcept
+    : Environment_base(std::move(parent))
+{
+  impl->slot_names = std::move(slot_names);
+  impl->slots = std::move(slots);
+}
+
 auto Environment_base::parent(Environment parent_value) noexcept -> void { impl->parent = parent_value; }
 
-auto Environment_base::has(const std::string &key) const noexcept -> bool
+auto Environment_base::find_local(const Symbol &key) const noexcept -> Variant *
 {
-  if (impl->map.find(key) != std::cend(impl->map)) {
-    return true;
+  if (impl->slot_names) {
+    // Later slots win, as if the arguments had been set in order.
+    for (auto i = impl->slot_names->size(); i-- > 0;) {
+      if ((*impl->slot_names)[i] == key) {
+        return &impl->slots[i];
+      }
+    }
   }
-  if (impl->parent) {
-    return impl->parent->has(key);
+  const auto item = impl->map.find(key);
+  return item != std::end(impl->map) ? &item->second : nullptr;
+}
+
+auto Environment_base::lookup(const Symbol &key, Variant &value) const -> bool
+{
+  for (auto environment = this; environment; environment = environment->impl->parent.get()) {
+    const Read_lock<Locks> lock(environment->impl->locks.get());
+    const auto found = environment->find_local(key);
+    if (found) {
+      value = *found;
+      return true;
+    }
   }
   return false;
 }
 
-const Variant &Environment_base::get(const std::string &key) const
+auto Environment_base::has(const Symbol &key) const -> bool
 {
-  if (has(key)) {
-    if (impl->map.find(key) != std::cend(impl->map)) {
-      return impl->map.at(key);
+  for (auto environment = this; environment; environment = environment->impl->parent.get()) {
+    const Read_lock<Locks> lock(environment->impl->locks.get());
+    if (environment->find_local(key)) {
+      return true;
     }
-    if (impl->parent) {
-      return impl->parent->get(key);
+  }
+  return false;
+}
+
+auto Environment_base::has(const std::string &key) const -> bool
+{
+  // A name that was never interned cannot be bound, and interning it here would keep it in the table for good.
+  auto symbol = Symbol();
+  return find_symbol(key, symbol) && has(symbol);
+}
+
+const Variant &Environment_base::get(const Symbol &key) const
+{
+  for (auto environment = this; environment; environment = environment->impl->parent.get()) {
+    const Read_lock<Locks> lock(environment->impl->locks.get());
+    const auto value = environment->find_local(key);
+    if (value) {
+      return *value;
     }
   }
   throw std::runtime_error("Key does not exist in environment.");
 }
 
-auto Environment_base::set(std::string key, Variant value) noexcept -> void
+const Variant &Environment_base::get(const std::string &key) const
 {
-  if (!has(key) || (impl->map.find(key) != std::cend(impl->map))) {
-    impl->map[key] = value;
+  auto symbol = Symbol();
+  if (!find_symbol(key, symbol)) {
+    throw std::runtime_error("Key does not exist in environment.");
   }
-  else if (impl->parent) {
-    impl->parent->set(key, value);
+  return get(symbol);
+}
+
+auto Environment_base::set(const Symbol &key, Variant value) -> void
+{
+  for (auto environment = this; environment; environment = environment->impl->parent.get()) {
+    const auto locks = environment->impl->locks.get();
+    if (!locks) {
+      const auto existing = environment->find_local(key);
+      if (existing) {
+        *existing = std::move(value);
+        return;
+      }
+      continue;
+    }
+    // Looked for under the read lock first, so setting a variable that is not there does not hold up readers.
+    auto found = false;
+    {
+      const Read_lock<Locks> lock(locks);
+      found = environment->find_local(key) != nullptr;
+    }
+    if (found) {
+      // Variables are never removed, it is still there.
+      const Write_lock<Locks> lock(locks);
+      *environment->find_local(key) = std::move(value);
+      return;
+    }
   }
+  const Write_lock<Locks> lock(impl->locks.get());
+  impl->map[key] = std::move(value);
+}
+
+auto Environment_base::set(const std::string &key, Variant value) -> void { set(Symbol(key), std::move(value)); }
+auto Environment_base::slot(const std::size_t index) const noexcept -> const Variant & { return impl->slots[index]; }
+
+auto Environment_base::slot(const std::size_t index, Variant value) noexcept -> void
+{
+  impl->slots[index] = std::move(value);
 }
 
-auto Environment_base::to_string() const noexcept -> std::string
+auto Environment_base::rebind(std::shared_ptr<const Slot_names> slot_names, const Variant_list &slots) -> void
 {
-  if (impl->map.empty() && impl->parent) {
-    return std::string("{},") + impl->parent->to_string();
+  if (impl->slot_names) {
+    for (auto i = std::size_t(0), j = impl->slots.size(); i != j; ++i) {
+      const auto &slot_name = (*impl->slot_names)[i];
+      if (std::find(std::cbegin(*slot_names), std::cend(*slot_names), slot_name) == std::cend(*slot_names)) {
+        impl->map[slot_name] = std::move(impl->slots[i]);
+      }
+    }
   }
-  if (impl->map.empty()) {
-    return "{}";
+  impl->slot_names = std::move(slot_names);
+  impl->slots = slots;
+}
+
+auto Environment_base::reset(Environment parent, std::shared_ptr<const Slot_names> slot_names) -> void
+{
+  // Clearing keeps the capacity of the map and the slots, which is what makes reusing an environment cheap.
+  impl->map.clear();
+  impl->parent = std::move(parent);
+  impl->slots.clear();
+  if (slot_names) {
+    impl->slots.resize(slot_names->size());
   }
-  auto os = std::ostringstream();
-  auto i = std::cbegin(impl->map);
-  os << "{" << i->first << "=" << string_from(i->second) << ",";
-  ++i;
-  for (auto j = std::cend(impl->map); i != j; ++i) {
+  impl->slot_names = std::move(slot_names);
+  impl->output = nullptr;
+}
 
-    os << "," << i->first << "=" << string_from(i->second);
+auto Environment_base::to_string() const -> std::string
+{
+  const Read_lock<Locks> lock(impl->locks.get());
+  auto os = std::ostringstream();
+  auto separator = "";
+  os << "{";
+  if (impl->slot_names) {
+    for (auto i = std::size_t(0), j = impl->slots.size(); i != j; ++i, separator = ",") {
+      os << separator << (*impl->slot_names)[i].name() << "=" << string_from(impl->slots[i]);
+    }
+  }
+  for (const auto &item : impl->map) {
+    os << separator << item.first.name() << "=" << string_from(item.second);
+    separator = ",";
   }
   os << "}";
   if (impl->parent) {
@@ -70,9 +294,160 @@ auto Environment_base::to_string() const noexcept -> std::string
   return os.str();
 }
 
+auto Environment_base::output(Output sink) -> void
+{
+  const Write_lock<Locks> lock(impl->locks.get());
+  impl->output = std::move(sink);
+}
+
+auto Environment_base::output() const -> Output
+{
+  for (auto environment = this; environment; environment = environment->impl->parent.get()) {
+    const Read_lock<Locks> lock(environment->impl->locks.get());
+    if (environment->impl->output) {
+      return environment->impl->output;
+    }
+  }
+  return standard_output();
+}
+
+namespace {
+
+/*!
+ * \brief The built-in functions, bound in every environment created without a parent. They are ordinary variables,
+ *        so a program can set its own function of the same name, and calls to them go through Procedure like any.
+ */
+auto builtins() -> const std::vector<std::pair<Symbol, Variant>> &
+{
+  static const auto functions = std::vector<std::pair<Symbol, Variant>>{
+      {Symbol("pmap"), Variant(Variant_function([](Environment environment, const Variant_list &arguments) {
+         if (arguments.size() != 2) {
+           throw std::runtime_error("Invalid number of arguments.");
+         }
+         return parallel_map(std::move(environment), arguments[0], arguments[1]);
+       }))},
+      {Symbol("touch"), Variant(Variant_function([](Environment, const Variant_list &arguments) {
+         if (arguments.size() != 1) {
+           throw std::runtime_error("Invalid number of arguments.");
+         }
+         return touch(arguments[0]);
+       }))}};
+  return functions;
+}
+
+} // namespace
+
 auto create_environment(Environment parent) -> Environment
 {
-  return std::make_shared<Environment_base>(Environment_base(parent));
+  auto environment = std::make_shared<Environment_base>(Environment_base(parent));
+  if (!parent) {
+    for (const auto &builtin : builtins()) {
+      environment->set(builtin.first, builtin.second);
+    }
+  }
+  return environment;
+}
+
+auto create_concurrent_environment(Environment parent) -> Environment
+{
+  auto environment = create_environment(std::move(parent));
+  environment->impl->locks = std::unique_ptr<Environment_base::Locks>(new Environment_base::Locks());
+  return environment;
+}
+
+auto snapshot_environment(const Environment &environment) -> Environment
+{
+  // Made without the built-in functions, which come with the root it copies or the concurrent environment it links to.
+  auto snapshot = std::make_shared<Environment_base>(Environment_base(nullptr));
+  auto &map = snapshot->impl->map;
+  auto current = environment;
+  // The innermost binding of a name is copied first, emplace leaves it in place of any outer one.
+  for (; current && !current->impl->locks; current = current->impl->parent) {
+    const auto &impl = *current->impl;
+    if (!snapshot->impl->output) {
+      snapshot->impl->output = impl.output;
+    }
+    if (impl.slot_names) {
+      for (auto i = impl.slots.size(); i-- > 0;) {
+        map.emplace((*impl.slot_names)[i], impl.slots[i]);
+      }
+    }
+    for (const auto &item : impl.map) {
+      map.emplace(item);
+    }
+  }
+  snapshot->impl->parent = std::move(current);
+  return snapshot;
+}
+
+auto create_environment() -> Environment { return create_environment(nullptr); }
+
+auto create_environment(Environment parent, std::shared_ptr<const Slot_names> slot_names, Variant_list slots)
+    -> Environment
+{
+  return std::make_shared<Environment_base>(Environment_base(parent, std::move(slot_names), std::move(slots)));
 }
 
-auto create_environment() -> Environment { return std::make_shared<Environment_base>(Environment_base(nullptr)); }
+namespace {
+
+/*!
+ * \brief The environments of finished calls on this thread, emptied and waiting to be reused. The pool has a fixed
+ *        size so that returning an environment never allocates.
+ */
+struct Environment_pool final {
+  std::array<Environment, 256> environments;
+  std::size_t size = 0;
+};
+
+thread_local auto environment_pool = Environment_pool();
+
+/*!
+ * \brief The argument lists of finished calls on this thread, emptied and waiting to be reused, with a fixed size for
+ *        the same reason as the environment pool.
+ */
+struct Argument_pool final {
+  std::array<Variant_list, 64> argument_lists;
+  std::size_t size = 0;
+};
+
+thread_local auto argument_pool = Argument_pool();
+
+} // namespace
+
+auto acquire_environment(Environment parent, std::shared_ptr<const Slot_names> slot_names) -> Environment
+{
+  if (environment_pool.size == 0) {
+    auto slots = Variant_list(slot_names->size());
+    return create_environment(std::move(parent), std::move(slot_names), std::move(slots));
+  }
+  auto environment = std::move(environment_pool.environments[--environment_pool.size]);
+  environment->reset(std::move(parent), std::move(slot_names));
+  return environment;
+}
+
+auto release_environment(Environment environment) noexcept -> void
+{
+  // An environment something else still refers to (host code that kept it) stays with its owners.
+  if (environment.use_count() != 1 || environment_pool.size == environment_pool.environments.size()) {
+    return;
+  }
+  environment->reset(nullptr, nullptr);
+  environment_pool.environments[environment_pool.size++] = std::move(environment);
+}
+
+auto acquire_arguments() -> Variant_list
+{
+  if (argument_pool.size == 0) {
+    return Variant_list();
+  }
+  return std::move(argument_pool.argument_lists[--argument_pool.size]);
+}
+
+auto release_arguments(Variant_list arguments) noexcept -> void
+{
+  if (arguments.capacity() == 0 || argument_pool.size == argument_pool.argument_lists.size()) {
+    return;
+  }
+  arguments.clear();
+  argument_pool.argument_lists[argument_pool.size++] = std::move(arguments);
+}
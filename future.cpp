@@ -0,0 +1,109 @@
+#include "internal.hpp"
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
+struct Future_base::Impl final {
+  std::function<Variant()> computation = std::function<Variant()>();
+  std::atomic<bool> started = {false};
+  std::atomic<bool> finished = {false};
+  std::mutex mutex;
+  std::condition_variable finished_changed;
+  Variant value = Variant();
+  std::exception_ptr error = nullptr;
+};
+
+Future_base::Future_base(std::function<Variant()> computation) : impl(std::make_shared<Impl>())
+{
+  impl->computation = std::move(computation);
+}
+
+auto Future_base::run() const noexcept -> void
+{
+  if (impl->started.exchange(true)) {
+    return;
+  }
+  try {
+    impl->value = impl->computation();
+  }
+  catch (...) {
+    impl->error = std::current_exception();
+  }
+  // Lets go of what the computation holds on to (the environment of a future form) as soon as it is done.
+  impl->computation = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    impl->finished = true;
+  }
+  impl->finished_changed.notify_all();
+}
+
+auto Future_base::ready() const noexcept -> bool { return impl->finished; }
+
+auto Future_base::touch() const -> Variant
+{
+  run();
+  while (!impl->finished) {
+    if (!help_thread_pool()) {
+      // The computation runs elsewhere and can be waiting on tasks that are not queued yet, so the wait is short.
+      std::unique_lock<std::mutex> lock(impl->mutex);
+      impl->finished_changed.wait_for(lock, std::chrono::microseconds(100), [this] { return impl->finished.load(); });
+    }
+  }
+  if (impl->error) {
+    std::rethrow_exception(impl->error);
+  }
+  return impl->value;
+}
+
+namespace {
+
+struct Future_executor final {
+  std::mutex mutex;
+  Executor executor = nullptr;
+};
+
+auto future_executor() -> Future_executor &
+{
+  static Future_executor executor;
+  return executor;
+}
+
+} // namespace
+
+auto create_future(std::function<Variant()> computation) -> Future
+{
+  auto future = std::make_shared<Future_base>(std::move(computation));
+  auto &state = future_executor();
+  auto executor = Executor();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    executor = state.executor;
+  }
+  if (executor) {
+    executor([future] { future->run(); });
+  }
+  else {
+    // Without a pool the future is left for the first touch to run.
+    submit_to_thread_pool([future] { future->run(); });
+  }
+  return future;
+}
+
+auto set_future_executor(Executor executor) -> void
+{
+  auto &state = future_executor();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.executor = std::move(executor);
+}
+
+auto future_from(Environment environment, Variant function) -> Variant
+{
+  auto snapshot = snapshot_environment(environment);
+  return Variant(create_future([snapshot, function] { return function.function()(snapshot, empty_variant_list); }));
+}
+
+auto touch(const Variant &variant) -> Variant
+{
+  return variant.type() == Variant_type::future ? variant.future()->touch() : variant;
+}
@@ -0,0 +1,499 @@
+#include "internal.hpp"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+/*
+ * A program image is the tree a program runs, saved so it can be loaded without lexing, parsing, resolving or folding
+ * the source again. The layout is:
+ *
+ *   header   the magic "wlispast", the version and a byte order mark, each of the two a 32 bit word
+ *   strings  their count, then each one as its length and its characters
+ *   tree     the nodes in prefix order, each its Node_tag byte, its fields and then its children
+ *
+ * Counts, lengths, slots, lines and columns are unsigned LEB128 (7 bits to a byte, the high bit set on all but the
+ * last), numbers are doubles and integers 64 bit words as they are in memory. Files are mapped rather than read where
+ * the platform allows. String literals are used in place, their Variants keep the mapping alive, while names are
+ * copied into the nodes that hold them. A string literal's token is saved without its text, which is its value in
+ * quotes.
+ */
+#if defined(__unix__) || defined(__APPLE__)
+#define WLISP_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+static constexpr char magic[8] = {'w', 'l', 'i', 's', 'p', 'a', 's', 't'};
+static constexpr auto version = std::uint32_t(4);
+static constexpr auto byte_order = std::uint32_t(0x01020304);
+
+auto append_word(std::string &output, const std::uint32_t word) -> void
+{
+  char bytes[sizeof(word)];
+  std::memcpy(bytes, &word, sizeof(word));
+  output.append(bytes, sizeof(bytes));
+}
+
+auto append_size(std::string &output, std::size_t value) -> void
+{
+  while (value >= 0x80) {
+    output += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  output += static_cast<char>(value);
+}
+
+auto corrupt() -> std::runtime_error { return std::runtime_error("Program image is corrupt."); }
+
+/*!
+ * \brief The contents of a file, mapped into memory (or read into it where mapping is not available).
+ */
+class Mapped_file final {
+public:
+  explicit Mapped_file(const std::string &path);
+  ~Mapped_file() noexcept;
+
+  Mapped_file(const Mapped_file &) = delete;
+  Mapped_file(Mapped_file &&) = delete;
+  Mapped_file &operator=(const Mapped_file &) = delete;
+  Mapped_file &operator=(Mapped_file &&) = delete;
+
+  auto data() const noexcept -> const char * { return begin; }
+  auto size() const noexcept -> std::size_t { return length; }
+
+private:
+  const char *begin = nullptr;
+  std::size_t length = 0;
+#ifndef WLISP_MMAP
+  std::string contents = std::string();
+#endif
+};
+
+#ifdef WLISP_MMAP
+Mapped_file::Mapped_file(const std::string &path)
+{
+  const auto file = ::open(path.c_str(), O_RDONLY);
+  if (file < 0) {
+    throw std::runtime_error("Could not open " + path + ".");
+  }
+  struct stat status;
+  if (::fstat(file, &status) != 0) {
+    ::close(file);
+    throw std::runtime_error("Could not open " + path + ".");
+  }
+  length = static_cast<std::size_t>(status.st_size);
+  // An empty file cannot be mapped, it is left to fail as too short for the header.
+  if (length != 0) {
+    const auto mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+    if (mapping == MAP_FAILED) {
+      ::close(file);
+      throw std::runtime_error("Could not map " + path + ".");
+    }
+    begin = static_cast<const char *>(mapping);
+  }
+  // The mapping stays valid once the file is closed.
+  ::close(file);
+}
+
+Mapped_file::~Mapped_file() noexcept
+{
+  if (begin) {
+    ::munmap(const_cast<char *>(begin), length);
+  }
+}
+#else
+Mapped_file::Mapped_file(const std::string &path)
+{
+  auto file = std::ifstream(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Could not open " + path + ".");
+  }
+  contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  begin = contents.data();
+  length = contents.size();
+}
+
+Mapped_file::~Mapped_file() noexcept = default;
+#endif
+
+/*!
+ * \brief Reads a program image back, checking every read against the end of the image, every slot against the
+ *        parameters of the lambda it is read in and every tail call against its position.
+ */
+class Image_reader final {
+public:
+  /*!
+   * \brief Reads the image between begin and end, which the owner keeps alive for the string literals read from it.
+   */
+  Image_reader(std::shared_ptr<const void> owner, const char *begin, const char *end);
+
+  auto node() -> Node_tag;
+  auto size() -> std::size_t;
+  auto slot() -> std::size_t;
+  auto flag() -> bool;
+  auto string() -> std::string;
+  auto slice() -> String_slice;
+  auto token() -> Token;
+  auto variant() -> Variant;
+  auto ast() -> AST;
+  auto finished() const noexcept -> bool { return current == end; }
+
+private:
+  auto byte() -> std::uint8_t;
+  auto bytes(const std::size_t count) -> const char *;
+
+  struct String final {
+    const char *characters;
+    std::size_t length;
+  };
+
+  auto indexed_string() -> const String &;
+
+  std::shared_ptr<const void> owner;
+  const char *current;
+  const char *end;
+  std::vector<String> strings = std::vector<String>();
+  std::size_t parameter_count = 0;
+  bool tail_position = false;
+};
+
+Image_reader::Image_reader(std::shared_ptr<const void> owner, const char *begin, const char *end)
+    : owner(std::move(owner)), current(begin), end(end)
+{
+  if (static_cast<std::size_t>(end - begin) < sizeof(magic) + 2 * sizeof(std::uint32_t) ||
+      std::memcmp(begin, magic, sizeof(magic)) != 0) {
+    throw std::runtime_error("Not a program image.");
+  }
+  current += sizeof(magic);
+  auto words = std::uint32_t();
+  std::memcpy(&words, bytes(sizeof(words)), sizeof(words));
+  auto order = std::uint32_t();
+  std::memcpy(&order, bytes(sizeof(order)), sizeof(order));
+  if (words != version || order != byte_order) {
+    throw std::runtime_error("Program image is of another version or byte order.");
+  }
+  const auto count = size();
+  for (auto i = std::size_t(0); i != count; ++i) {
+    const auto length = size();
+    strings.emplace_back(String{bytes(length), length});
+  }
+}
+
+auto Image_reader::byte() -> std::uint8_t { return static_cast<std::uint8_t>(*bytes(1)); }
+
+auto Image_reader::bytes(const std::size_t count) -> const char *
+{
+  if (static_cast<std::size_t>(end - current) < count) {
+    throw corrupt();
+  }
+  const auto start = current;
+  current += count;
+  return start;
+}
+
+auto Image_reader::node() -> Node_tag
+{
+  const auto tag = byte();
+  if (tag > static_cast<std::uint8_t>(Node_tag::atomic)) {
+    throw corrupt();
+  }
+  return static_cast<Node_tag>(tag);
+}
+
+auto Image_reader::size() -> std::size_t
+{
+  auto value = std::size_t(0);
+  for (auto shift = 0u; shift < 64; shift += 7) {
+    const auto next = byte();
+    value |= static_cast<std::size_t>(next & 0x7f) << shift;
+    if ((next & 0x80) == 0) {
+      return value;
+    }
+  }
+  throw corrupt();
+}
+
+auto Image_reader::slot() -> std::size_t
+{
+  // Written one higher, so no_slot is 0. A slot indexes the parameters of the enclosing lambda, and is used unchecked.
+  const auto value = size();
+  if (value > parameter_count) {
+    throw corrupt();
+  }
+  return value == 0 ? no_slot : value - 1;
+}
+
+auto Image_reader::flag() -> bool { return byte() != 0; }
+
+auto Image_reader::indexed_string() -> const String &
+{
+  const auto index = size();
+  if (index >= strings.size()) {
+    throw corrupt();
+  }
+  return strings[index];
+}
+
+auto Image_reader::string() -> std::string
+{
+  const auto &entry = indexed_string();
+  return std::string(entry.characters, entry.length);
+}
+
+auto Image_reader::slice() -> String_slice
+{
+  const auto &entry = indexed_string();
+  return String_slice(owner, entry.characters, entry.length);
+}
+
+auto Image_reader::token() -> Token
+{
+  const auto type = byte();
+  if (type > static_cast<std::uint8_t>(Token_type::right_parenthesis)) {
+    throw corrupt();
+  }
+  auto value = string();
+  const auto line = size();
+  const auto column = size();
+  return Token(static_cast<Token_type>(type), std::move(value), line, column);
+}
+
+auto Image_reader::variant() -> Variant
+{
+  switch (static_cast<Variant_type>(byte())) {
+  case Variant_type::nil:
+    return Variant();
+  case Variant_type::number: {
+    auto number = 0.0;
+    std::memcpy(&number, bytes(sizeof(number)), sizeof(number));
+    return Variant(number);
+  }
+  case Variant_type::integer: {
+    auto integer = std::int64_t(0);
+    std::memcpy(&integer, bytes(sizeof(integer)), sizeof(integer));
+    return Variant(integer);
+  }
+  case Variant_type::string:
+    return Variant(slice());
+  case Variant_type::boolean:
+    return Variant(flag());
+  case Variant_type::list: {
+    const auto count = size();
+    auto list = Variant_list();
+    for (auto i = std::size_t(0); i != count; ++i) {
+      list.emplace_back(variant());
+    }
+    return Variant(std::move(list));
+  }
+  case Variant_type::array: {
+    const auto count = size();
+    if (count > static_cast<std::size_t>(end - current) / sizeof(double)) {
+      throw corrupt();
+    }
+    auto array = Number_array(count);
+    const auto values = bytes(count * sizeof(double));
+    if (count != 0) {
+      std::memcpy(array.data(), values, count * sizeof(double));
+    }
+    return Variant(std::move(array));
+  }
+  case Variant_type::function:
+  case Variant_type::future:
+    break;
+  }
+  throw corrupt();
+}
+
+auto Image_reader::ast() -> AST
+{
+  // The body of a lambda is in tail position and so are the branches of an if that is, nothing else is. A tail call
+  // anywhere else would have the bytecode machine reuse a frame that is still in use, or one that does not exist.
+  const auto tail = tail_position;
+  tail_position = false;
+  switch (node()) {
+  case Node_tag::if_: {
+    auto test = ast();
+    tail_position = tail;
+    auto consequent = ast();
+    tail_position = tail;
+    auto alternate = ast();
+    return If(std::move(test), std::move(consequent), std::move(alternate)).clone();
+  }
+  case Node_tag::procedure: {
+    auto identifier = token();
+    const auto procedure_slot = slot();
+    const auto tail_call = flag();
+    if (tail_call && !tail) {
+      throw corrupt();
+    }
+    return Procedure(std::move(identifier), ast(), procedure_slot, tail_call).clone();
+  }
+  case Node_tag::lambda: {
+    const auto count = size();
+    auto parameters = Token_list();
+    for (auto i = std::size_t(0); i != count; ++i) {
+      parameters.emplace_back(token());
+    }
+    auto name = profile_name(string());
+    const auto memoized = flag();
+    const auto enclosing_count = parameter_count;
+    parameter_count = count;
+    tail_position = true;
+    auto body = ast();
+    parameter_count = enclosing_count;
+    return Lambda(std::move(parameters), std::move(body), std::move(name), memoized).clone();
+  }
+  case Node_tag::list: {
+    const auto count = size();
+    auto ast_list = AST_list();
+    for (auto i = std::size_t(0); i != count; ++i) {
+      ast_list.emplace_back(ast());
+    }
+    return List(std::move(ast_list)).clone();
+  }
+  case Node_tag::operator_: {
+    auto operation = token();
+    auto left = ast();
+    auto right = ast();
+    return operator_from(std::move(operation), std::move(left), std::move(right));
+  }
+  case Node_tag::unary_operator: {
+    auto operation = token();
+    return unary_operator_from(std::move(operation), ast());
+  }
+  case Node_tag::parallel_begin:
+    return Parallel_begin(ast()).clone();
+  case Node_tag::future:
+    return Future_form(ast()).clone();
+  case Node_tag::print_line:
+    return Print_line(ast()).clone();
+  case Node_tag::variable: {
+    auto variable = token();
+    return Variable(std::move(variable), slot()).clone();
+  }
+  case Node_tag::set: {
+    auto identifier = token();
+    const auto set_slot = slot();
+    return Set(std::move(identifier), ast(), set_slot).clone();
+  }
+  case Node_tag::atomic: {
+    auto atomic = token();
+    return Atomic(std::move(atomic), variant()).clone();
+  }
+  }
+  throw corrupt();
+}
+
+} // namespace
+
+auto Image_writer::node(const Node_tag tag) -> void { tree += static_cast<char>(tag); }
+
+auto Image_writer::size(const std::size_t value) -> void { append_size(tree, value); }
+
+auto Image_writer::slot(const std::size_t slot) -> void { append_size(tree, slot == no_slot ? 0 : slot + 1); }
+
+auto Image_writer::flag(const bool value) -> void { tree += static_cast<char>(value ? 1 : 0); }
+
+auto Image_writer::string(const std::string &value) -> void
+{
+  const auto found = string_indices.find(value);
+  if (found != std::end(string_indices)) {
+    append_size(tree, found->second);
+    return;
+  }
+  const auto index = string_indices.size();
+  string_indices.emplace(value, index);
+  append_size(strings, value.size());
+  strings += value;
+  append_size(tree, index);
+}
+
+auto Image_writer::token(const Token &token) -> void
+{
+  tree += static_cast<char>(token.type());
+  string(token.value());
+  size(token.line());
+  size(token.column());
+}
+
+auto Image_writer::variant(const Variant &value) -> void
+{
+  tree += static_cast<char>(value.type());
+  switch (value.type()) {
+  case Variant_type::nil:
+    break;
+  case Variant_type::number: {
+    const auto number = value.number();
+    char bytes[sizeof(number)];
+    std::memcpy(bytes, &number, sizeof(number));
+    tree.append(bytes, sizeof(bytes));
+    break;
+  }
+  case Variant_type::integer: {
+    const auto integer = value.integer();
+    char bytes[sizeof(integer)];
+    std::memcpy(bytes, &integer, sizeof(integer));
+    tree.append(bytes, sizeof(bytes));
+    break;
+  }
+  case Variant_type::string:
+    string(value.string());
+    break;
+  case Variant_type::boolean:
+    flag(value.boolean());
+    break;
+  case Variant_type::list:
+    size(value.list().size());
+    for (const auto &item : value.list()) {
+      variant(item);
+    }
+    break;
+  case Variant_type::array:
+    size(value.array().size());
+    tree.append(reinterpret_cast<const char *>(value.array().data()), value.array().size() * sizeof(double));
+    break;
+  case Variant_type::function:
+  case Variant_type::future:
+    throw std::runtime_error("A " + string_from(value.type()) + " cannot be saved in a program image.");
+  }
+}
+
+auto Image_writer::ast(const AST &ast) -> void { ast->save(*this); }
+
+auto Image_writer::image() const -> std::string
+{
+  auto image = std::string(magic, sizeof(magic));
+  append_word(image, version);
+  append_word(image, byte_order);
+  append_size(image, string_indices.size());
+  image += strings;
+  image += tree;
+  return image;
+}
+
+auto save_image(const AST &ast, const std::string &path) -> void
+{
+  auto writer = Image_writer();
+  writer.ast(ast);
+  const auto image = writer.image();
+  auto file = std::ofstream(path, std::ios::binary | std::ios::trunc);
+  if (!file.write(image.data(), static_cast<std::streamsize>(image.size())) || !file.flush()) {
+    throw std::runtime_error("Could not write " + path + ".");
+  }
+}
+
+auto load_image(const std::string &path) -> AST
+{
+  const auto file = std::make_shared<const Mapped_file>(path);
+  auto reader = Image_reader(file, file->data(), file->data() + file->size());
+  auto ast = reader.ast();
+  if (!reader.finished()) {
+    throw corrupt();
+  }
+  return ast;
+}
@@ -6,6 +6,9 @@
  */
 
 #include "wlisp.hpp"
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
 
 enum class Token_type { nil, number, string, boolean, identifier, left_parenthesis, right_parenthesis };
 
@@ -14,7 +17,8 @@ auto string_from(const Token_type &token_type) -> std::string;
 class Token final {
 public:
   Token();
-  Token(const Token_type token_type, std::string token_value);
+  Token(const Token_type token_type, std::string token_value, const std::size_t line = 0,
+        const std::size_t column = 0);
 
   ~Token() noexcept = default;
   Token(const Token &) = default;
@@ -24,6 +28,9 @@ public:
 
   const Token_type &type() const noexcept;
   const std::string &value() const noexcept;
+  const Symbol &symbol() const noexcept;
+  auto line() const noexcept -> std::size_t;
+  auto column() const noexcept -> std::size_t;
 
 private:
   struct Impl;
@@ -32,21 +39,104 @@ private:
 
 using Token_list = std::vector<Token>;
 
-auto consume_from(Token_list &token_list) -> Token;
+/*!
+ * \brief A read position into a Token_list, the parser advances it instead of erasing consumed tokens.
+ */
+struct Token_cursor final {
+  Token_list::const_iterator current;
+  Token_list::const_iterator end;
+};
+
+auto cursor_from(const Token_list &token_list) noexcept -> Token_cursor;
+auto peek_from(const Token_cursor &token_cursor) -> const Token &;
+auto consume_from(Token_cursor &token_cursor) -> const Token &;
 auto string_from(const Token &token) noexcept -> std::string;
 auto variant_from(const Token &token) -> Variant;
 
+/*!
+ * \brief Returns the characters as a slice of the one buffer shared by every interned string equal to them, string
+ *        literals are interned so identical ones are stored once. The characters are only copied when they are new.
+ */
+auto intern(const char *characters, const std::size_t size) -> String_slice;
+
+/*!
+ * \brief Hashes characters in place (FNV-1a), so a slice of a larger buffer is hashed without copying it out.
+ */
+auto hash_characters(const char *characters, const std::size_t size) noexcept -> std::size_t;
+
 auto operator==(const Token &left, const Token &right) -> bool;
 auto operator!=(const Token &left, const Token &right) -> bool;
 
-auto lexical_analysis(const std::string &input) -> Token_list;
+/*!
+ * \brief Splits the given input into tokens. The line and column are those of the first character, for input that
+ *        starts further into a larger source.
+ */
+auto lexical_analysis(const std::string &input, const std::size_t first_line = 1, const std::size_t first_column = 1)
+    -> Token_list;
+
+/*!
+ * \brief The instructions of the bytecode machine. Each one consumes its operands from the top of the stack and
+ *        pushes its result.
+ */
+enum class Opcode : std::uint8_t {
+  constant,
+  load_slot,
+  load_name,
+  load_procedure,
+  store_slot,
+  store_name,
+  jump,
+  jump_if_false,
+  make_list,
+  add,
+  subtract,
+  multiply,
+  divide,
+  less,
+  greater,
+  less_equal,
+  greater_equal,
+  equal,
+  dot,
+  make_array,
+  sum,
+  minimum,
+  maximum,
+  print_line,
+  memoize,
+  parallel_call,
+  future,
+  call,
+  tail_call,
+  return_
+};
 
 class AST_base;
 
 using AST = std::shared_ptr<AST_base>;
 
+struct Prototype;
+
+class Image_writer;
+
 using AST_list = std::vector<AST>;
 
+/*!
+ * \brief Marks an identifier that was not resolved to a slot and is looked up by name.
+ */
+static constexpr auto no_slot = static_cast<std::size_t>(-1);
+
+/*!
+ * \brief The name the profiler reports a lambda by. It is shared by the lambda's nodes and prototypes rather than
+ *        interned, so lambdas parsed at ever new positions do not pile up names in the symbol table.
+ */
+using Profile_name = std::shared_ptr<const std::string>;
+
+/*!
+ * \brief Returns a new profile name, which is only freed while the profiler is not reading the stacks it may be on.
+ */
+auto profile_name(std::string name) -> Profile_name;
+
 class AST_base {
 public:
   AST_base() noexcept = default;
@@ -58,6 +148,44 @@ public:
 
   virtual auto clone() const noexcept -> AST = 0;
   virtual auto execute(Environment environment, const Variant_list &) const -> Variant = 0;
+
+  /*!
+   * \brief Returns a copy of the tree with identifiers naming one of the given parameters (those of the innermost
+   *        lambda) resolved to their slot in the lambda's environment.
+   */
+  virtual auto resolve(const Token_list &parameters) const -> AST = 0;
+
+  /*!
+   * \brief Appends the bytecode evaluating this node (leaving its value on the stack) to the prototype.
+   */
+  virtual auto compile(Prototype &prototype) const -> void = 0;
+
+  /*!
+   * \brief Appends this node and its children to a program image.
+   */
+  virtual auto save(Image_writer &writer) const -> void = 0;
+
+  /*!
+   * \brief Returns a copy of the tree with the calls whose value becomes the value of this node marked as tail
+   *        calls, used on lambda bodies. By default a node has no calls in tail position.
+   */
+  virtual auto tail() const -> AST;
+
+  /*!
+   * \brief Returns a copy of the tree with operators on constants replaced by their value and ifs with a constant test
+   *        replaced by the branch taken, adding the number of nodes this removed to the given count.
+   */
+  virtual auto fold(std::size_t &removed) const -> AST = 0;
+
+  /*!
+   * \brief Returns the value of this node when it is known without running it, otherwise nullptr.
+   */
+  virtual auto constant() const noexcept -> const Variant *;
+
+  /*!
+   * \brief Returns the number of nodes in the tree.
+   */
+  virtual auto size() const noexcept -> std::size_t = 0;
 };
 
 class If : public AST_base {
@@ -73,6 +201,12 @@ public:
 
   auto clone() const noexcept -> AST;
   auto execute(Environment environment, const Variant_list &) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
+  auto tail() const -> AST;
 
 private:
   struct Impl;
@@ -81,7 +215,7 @@ private:
 
 class Procedure final : public AST_base {
 public:
-  Procedure(Token identifier, AST arguments) noexcept;
+  Procedure(Token identifier, AST arguments, const std::size_t slot = no_slot, const bool tail_call = false) noexcept;
 
   Procedure() = delete;
   virtual ~Procedure() noexcept;
@@ -92,6 +226,12 @@ public:
 
   auto clone() const noexcept -> AST;
   auto execute(Environment environment, const Variant_list &variant_list) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
+  auto tail() const -> AST;
 
 private:
   struct Impl;
@@ -100,7 +240,7 @@ private:
 
 class Lambda final : public AST_base {
 public:
-  Lambda(Token_list parameters, AST body);
+  Lambda(Token_list parameters, AST body, Profile_name name, const bool memoized = false);
 
   Lambda() = delete;
   virtual ~Lambda() noexcept;
@@ -111,6 +251,16 @@ public:
 
   auto clone() const noexcept -> AST;
   auto execute(Environment environment, const Variant_list &) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
+
+  /*!
+   * \brief Returns a copy of the lambda with the given name, which the profiler reports it by.
+   */
+  auto named(Profile_name name) const -> AST;
 
 private:
   struct Impl;
@@ -130,13 +280,29 @@ public:
 
   auto clone() const noexcept -> AST;
   auto execute(Environment environment, const Variant_list &variant_list) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
+  auto compile_items(Prototype &prototype) const -> std::size_t;
+
+  /*!
+   * \brief Appends the values of the items to the given list, without building a list Variant (used for the
+   *        arguments of a call).
+   */
+  auto execute_items(Environment environment, const Variant_list &variant_list, Variant_list &values) const -> void;
 
 private:
   struct Impl;
   std::shared_ptr<Impl> impl;
 };
 
-class Operator final : public AST_base {
+/*!
+ * \brief An operation on two values. There is one node type per operator (the instruction it compiles to), so the
+ *        operator is chosen once when parsing instead of every time the node runs.
+ */
+template <Opcode opcode> class Operator final : public AST_base {
 public:
   explicit Operator(Token operation, AST left, AST right);
 
@@ -149,6 +315,94 @@ public:
 
   auto clone() const noexcept -> AST;
   auto execute(Environment environment, const Variant_list &variant_list) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
+
+private:
+  struct Impl;
+  std::shared_ptr<Impl> impl;
+};
+
+/*!
+ * \brief A (parallel-begin forms...), each form is the body of a lambda without parameters (so it runs in an
+ *        environment of its own linked to the current one), and the lambdas are called in parallel.
+ */
+class Parallel_begin final : public AST_base {
+public:
+  explicit Parallel_begin(AST thunks);
+
+  Parallel_begin() = delete;
+  virtual ~Parallel_begin() noexcept;
+  Parallel_begin(const Parallel_begin &) noexcept = default;
+  Parallel_begin(Parallel_begin &&) noexcept = default;
+  Parallel_begin &operator=(const Parallel_begin &) noexcept = default;
+  Parallel_begin &operator=(Parallel_begin &&) noexcept = default;
+
+  auto clone() const noexcept -> AST;
+  auto execute(Environment environment, const Variant_list &variant_list) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
+
+private:
+  struct Impl;
+  std::shared_ptr<Impl> impl;
+};
+
+/*!
+ * \brief A (future expression), the expression is the body of a lambda without parameters, called in the
+ *        background (see future_from).
+ */
+class Future_form final : public AST_base {
+public:
+  explicit Future_form(AST thunk);
+
+  Future_form() = delete;
+  virtual ~Future_form() noexcept;
+  Future_form(const Future_form &) noexcept = default;
+  Future_form(Future_form &&) noexcept = default;
+  Future_form &operator=(const Future_form &) noexcept = default;
+  Future_form &operator=(Future_form &&) noexcept = default;
+
+  auto clone() const noexcept -> AST;
+  auto execute(Environment environment, const Variant_list &variant_list) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
+
+private:
+  struct Impl;
+  std::shared_ptr<Impl> impl;
+};
+
+/*!
+ * \brief An operation on one value, with a node type per operation as for Operator.
+ */
+template <Opcode opcode> class Unary_operator final : public AST_base {
+public:
+  explicit Unary_operator(Token operation, AST operand);
+
+  Unary_operator() = delete;
+  virtual ~Unary_operator() noexcept;
+  Unary_operator(const Unary_operator &) = default;
+  Unary_operator(Unary_operator &&) noexcept = default;
+  Unary_operator &operator=(const Unary_operator &) = default;
+  Unary_operator &operator=(Unary_operator &&) = default;
+
+  auto clone() const noexcept -> AST;
+  auto execute(Environment environment, const Variant_list &variant_list) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
 
 private:
   struct Impl;
@@ -168,6 +422,11 @@ public:
 
   auto clone() const noexcept -> AST;
   auto execute(Environment environment, const Variant_list &variant_list) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
 
 private:
   struct Impl;
@@ -176,7 +435,7 @@ private:
 
 class Variable final : public AST_base {
 public:
-  explicit Variable(Token token);
+  explicit Variable(Token token, const std::size_t slot = no_slot);
 
   Variable() = delete;
   virtual ~Variable() noexcept;
@@ -187,6 +446,11 @@ public:
 
   auto clone() const noexcept -> AST;
   auto execute(Environment environment, const Variant_list &) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
 
 private:
   struct Impl;
@@ -195,7 +459,7 @@ private:
 
 class Set final : public AST_base {
 public:
-  explicit Set(Token identifier, AST value);
+  explicit Set(Token identifier, AST value, const std::size_t slot = no_slot);
 
   Set() = delete;
   virtual ~Set() noexcept;
@@ -206,6 +470,11 @@ public:
 
   auto clone() const noexcept -> AST;
   auto execute(Environment environment, const Variant_list &variant_list) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
 
 private:
   struct Impl;
@@ -215,6 +484,7 @@ private:
 class Atomic final : public AST_base {
 public:
   explicit Atomic(Token token);
+  Atomic(Token token, Variant value);
 
   Atomic() = delete;
   virtual ~Atomic() noexcept;
@@ -225,12 +495,342 @@ public:
 
   auto clone() const noexcept -> AST;
   auto execute(Environment environment, const Variant_list &) const -> Variant;
+  auto resolve(const Token_list &parameters) const -> AST;
+  auto compile(Prototype &prototype) const -> void;
+  auto save(Image_writer &writer) const -> void;
+  auto fold(std::size_t &removed) const -> AST;
+  auto size() const noexcept -> std::size_t;
+  auto constant() const noexcept -> const Variant *;
 
 private:
   struct Impl;
   std::shared_ptr<Impl> impl;
 };
 
-auto parse_from(Token_list &token_list) -> AST;
+/*!
+ * \brief A tree after constant folding and the number of nodes folding removed from it.
+ */
+struct Folded final {
+  AST ast;
+  std::size_t removed;
+};
+
+/*!
+ * \brief Returns the Operator node for the operator the given token names.
+ */
+auto operator_from(Token operation, AST left, AST right) -> AST;
+
+/*!
+ * \brief Returns the Unary_operator node for the operation the given token names.
+ */
+auto unary_operator_from(Token operation, AST operand) -> AST;
+
+auto parse_from(Token_cursor &token_cursor) -> AST;
+auto parse_from(const Token_list &token_list) -> AST;
+auto resolve(const AST &ast) -> AST;
+auto fold(const AST &ast) -> Folded;
+
+struct Instruction final {
+  Opcode opcode;
+  std::uint32_t operand;
+};
+
+/*!
+ * \brief A compiled lambda (or top level expression when there are no slot names) and the constants and symbols its
+ *        instructions refer to by index.
+ */
+struct Prototype final {
+  std::vector<Instruction> code = std::vector<Instruction>();
+  Variant_list constants = Variant_list();
+  std::vector<Symbol> symbols = std::vector<Symbol>();
+  std::shared_ptr<const Slot_names> slot_names = nullptr;
+  Profile_name name = nullptr;
+};
+
+auto emit(Prototype &prototype, const Opcode opcode, const std::size_t operand = 0) -> std::size_t;
+auto patch(Prototype &prototype, const std::size_t instruction) -> void;
+auto constant_from(Prototype &prototype, Variant constant) -> std::size_t;
+auto symbol_from(Prototype &prototype, const Symbol &symbol) -> std::size_t;
+auto compile_lambda(const Profile_name &name, std::shared_ptr<const Slot_names> slot_names, const AST &body)
+    -> Variant;
+auto compile(const AST &ast) -> std::shared_ptr<const Prototype>;
+auto run(const Prototype &prototype, Environment environment, const Variant_list &arguments) -> Variant;
+
+/*!
+ * \brief The kinds of node in a program image, each followed there by its fields and then its children.
+ */
+enum class Node_tag : std::uint8_t {
+  if_,
+  procedure,
+  lambda,
+  list,
+  operator_,
+  unary_operator,
+  parallel_begin,
+  future,
+  print_line,
+  variable,
+  set,
+  atomic
+};
+
+/*!
+ * \brief Builds a program image (see Program::save). The nodes of the tree are written in prefix order, and every
+ *        string they hold is written once to a table ahead of them and referred to by its index.
+ */
+class Image_writer final {
+public:
+  Image_writer() = default;
+
+  auto node(const Node_tag tag) -> void;
+  auto size(const std::size_t value) -> void;
+  auto slot(const std::size_t slot) -> void;
+  auto flag(const bool value) -> void;
+  auto string(const std::string &value) -> void;
+  auto token(const Token &token) -> void;
+  auto variant(const Variant &value) -> void;
+  auto ast(const AST &ast) -> void;
+
+  /*!
+   * \brief Returns the image of everything written, with its header.
+   */
+  auto image() const -> std::string;
+
+private:
+  std::string strings = std::string();
+  std::string tree = std::string();
+  std::unordered_map<std::string, std::size_t> string_indices = std::unordered_map<std::string, std::size_t>();
+};
+
+auto save_image(const AST &ast, const std::string &path) -> void;
+
+/*!
+ * \brief Reads back the tree of a program image written by save_image. Throws when the file is not an image of
+ *        this version.
+ */
+auto load_image(const std::string &path) -> AST;
+
+/*
+ * Integer arithmetic, exact while the result fits in 64 bits. A result that does not fit is computed on doubles
+ * instead, as is a quotient that is not whole.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+inline auto add_overflows(const std::int64_t left, const std::int64_t right, std::int64_t &result) noexcept -> bool
+{
+  return __builtin_add_overflow(left, right, &result);
+}
+
+inline auto subtract_overflows(const std::int64_t left, const std::int64_t right, std::int64_t &result) noexcept
+    -> bool
+{
+  return __builtin_sub_overflow(left, right, &result);
+}
+
+inline auto multiply_overflows(const std::int64_t left, const std::int64_t right, std::int64_t &result) noexcept
+    -> bool
+{
+  return __builtin_mul_overflow(left, right, &result);
+}
+#else
+inline auto add_overflows(const std::int64_t left, const std::int64_t right, std::int64_t &result) noexcept -> bool
+{
+  if ((right > 0 && left > INT64_MAX - right) || (right < 0 && left < INT64_MIN - right)) {
+    return true;
+  }
+  result = left + right;
+  return false;
+}
+
+inline auto subtract_overflows(const std::int64_t left, const std::int64_t right, std::int64_t &result) noexcept
+    -> bool
+{
+  if ((right < 0 && left > INT64_MAX + right) || (right > 0 && left < INT64_MIN + right)) {
+    return true;
+  }
+  result = left - right;
+  return false;
+}
+
+inline auto multiply_overflows(const std::int64_t left, const std::int64_t right, std::int64_t &result) noexcept
+    -> bool
+{
+  if (left > 0 ? (right > 0 ? left > INT64_MAX / right : right < INT64_MIN / left)
+               : (right > 0 ? left < INT64_MIN / right : left != 0 && right < INT64_MAX / left)) {
+    return true;
+  }
+  result = left * right;
+  return false;
+}
+#endif
+
+inline auto integer_add(const std::int64_t left, const std::int64_t right) noexcept -> Variant
+{
+  auto result = std::int64_t(0);
+  return add_overflows(left, right, result) ? Variant(static_cast<double>(left) + static_cast<double>(right))
+                                            : Variant(result);
+}
+
+inline auto integer_subtract(const std::int64_t left, const std::int64_t right) noexcept -> Variant
+{
+  auto result = std::int64_t(0);
+  return subtract_overflows(left, right, result) ? Variant(static_cast<double>(left) - static_cast<double>(right))
+                                                 : Variant(result);
+}
+
+inline auto integer_multiply(const std::int64_t left, const std::int64_t right) noexcept -> Variant
+{
+  auto result = std::int64_t(0);
+  return multiply_overflows(left, right, result) ? Variant(static_cast<double>(left) * static_cast<double>(right))
+                                                 : Variant(result);
+}
+
+auto integer_divide(const std::int64_t left, const std::int64_t right) -> Variant;
+
+/*!
+ * \brief Applies the operator of the given opcode (+ - * / < > <= >=) to each element of one or two arrays, the
+ *        other operand can be a number. Both operands are taken to be arrays or numbers, and at least one an array.
+ */
+template <Opcode opcode> auto element_wise(const Variant &left, const Variant &right) -> Variant;
+
+/*!
+ * \brief Returns an array of the numbers in the given list (an array is returned as it is).
+ */
+auto array_from(const Variant &variant) -> Variant;
+
+auto array_sum(const Variant &variant) -> Variant;
+auto array_minimum(const Variant &variant) -> Variant;
+auto array_maximum(const Variant &variant) -> Variant;
+auto array_dot(const Variant &left, const Variant &right) -> Variant;
+
+/*!
+ * \brief Returns a function that caches the results of the given one, as a memo-lambda.
+ */
+auto memoize(Variant function) -> Variant;
+
+/*!
+ * \brief Calls each of the given functions without arguments on the thread pool, with the given environment as the
+ *        caller's, and returns the list of their results in the same order. The calls all finish even when some
+ *        throw, then the exception of the first of those is rethrown.
+ */
+auto parallel_call(Environment environment, const Variant_list &functions) -> Variant;
+
+/*!
+ * \brief Calls the given function with each item of the given list on the thread pool, as parallel_call. This is the
+ *        built-in function pmap, (pmap function list).
+ */
+auto parallel_map(Environment environment, const Variant &function, const Variant &list) -> Variant;
+
+/*!
+ * \brief Hands a task to the thread pool, returns false when there is none (it has a size of 1).
+ */
+auto submit_to_thread_pool(std::function<void()> task) -> bool;
+
+/*!
+ * \brief Runs one task waiting in the thread pool on the calling thread, returns false when there was none.
+ */
+auto help_thread_pool() -> bool;
+
+/*!
+ * \brief Returns an environment holding a copy of every variable the given one sees up to the first concurrent
+ *        environment in its chain, which becomes the parent of the copy. Nothing but the concurrent environments is
+ *        shared with the code still running in the given one.
+ */
+auto snapshot_environment(const Environment &environment) -> Environment;
+
+/*!
+ * \brief Returns a future calling the given function without arguments, with a snapshot of the given environment as
+ *        the caller's, scheduled on the future executor.
+ */
+auto future_from(Environment environment, Variant function) -> Variant;
+
+/*!
+ * \brief Returns the value of the given future once it is ready (rethrowing the exception the computation threw),
+ *        any other value is returned as it is. This is the built-in function touch, (touch value).
+ */
+auto touch(const Variant &variant) -> Variant;
+
+/*!
+ * \brief Returns an environment for a lambda call, with a nil slot for each of the given names. It is recycled from
+ *        the calling thread's pool of environments when there is one.
+ */
+auto acquire_environment(Environment parent, std::shared_ptr<const Slot_names> slot_names) -> Environment;
+
+/*!
+ * \brief Hands the environment of a finished call back to the calling thread's pool, if nothing else refers to it.
+ */
+auto release_environment(Environment environment) noexcept -> void;
+
+/*!
+ * \brief Returns an empty argument list, recycled (with its capacity) from the calling thread's pool when there is
+ *        one.
+ */
+auto acquire_arguments() -> Variant_list;
+
+/*!
+ * \brief Empties the argument list of a finished call and hands it back to the calling thread's pool.
+ */
+auto release_arguments(Variant_list arguments) noexcept -> void;
+
+/*!
+ * \brief The arguments of a call being made, evaluated straight into a list from the pool, which goes back to the
+ *        pool when the call is done.
+ */
+class Pooled_arguments final {
+public:
+  Pooled_arguments() : values(acquire_arguments()) {}
+  ~Pooled_arguments() noexcept { release_arguments(std::move(values)); }
+
+  Pooled_arguments(const Pooled_arguments &) = delete;
+  Pooled_arguments(Pooled_arguments &&) = delete;
+  Pooled_arguments &operator=(const Pooled_arguments &) = delete;
+  Pooled_arguments &operator=(Pooled_arguments &&) = delete;
+
+  Variant_list values;
+};
+
+/*!
+ * \brief Whether the profiler is running. Calls only touch the shadow stack while it is, otherwise a call costs this
+ *        one relaxed load.
+ */
+extern std::atomic<bool> profiler_running;
+
+auto push_profile_frame(const std::string &name) -> void;
+auto pop_profile_frame() noexcept -> void;
+auto replace_profile_frame(const std::string &name) -> void;
+
+/*!
+ * \brief Keeps a lambda call on the shadow stack for its lifetime, if the profiler was running when it started.
+ */
+class Profile_frame final {
+public:
+  explicit Profile_frame(const Profile_name &name) : active(profiler_running.load(std::memory_order_relaxed))
+  {
+    if (active) {
+      push_profile_frame(*name);
+    }
+  }
+
+  ~Profile_frame() noexcept
+  {
+    if (active) {
+      pop_profile_frame();
+    }
+  }
+
+  Profile_frame(const Profile_frame &) = delete;
+  Profile_frame(Profile_frame &&) = delete;
+  Profile_frame &operator=(const Profile_frame &) = delete;
+  Profile_frame &operator=(Profile_frame &&) = delete;
+
+  auto replace(const Profile_name &name) -> void
+  {
+    if (active) {
+      replace_profile_frame(*name);
+    }
+  }
+
+private:
+  bool active;
+};
 
 #endif // INTERNAL_HPP
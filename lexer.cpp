@@ -1,65 +1,193 @@
 #include "internal.hpp"
-#include <algorithm>
-#include <regex>
+#include <cctype>
+#include <stdexcept>
 
-auto lexical_analysis(const std::string &input) -> Token_list
+/*
+ * The scanners below each try to match one token class at the given position of the input and return the position
+ * one past the end of the match, or the starting position when nothing matches. They mirror the token grammar:
+ *
+ *   whitespace  \s
+ *   string      "(\\"|\\r|\\n|\\t|[^"])*"
+ *   number      -?[.]?[0-9]+[.]?[0-9]*
+ *   boolean     #t|#f
+ *   nil         nil
+ *   operator    <=|>=|<|>|=|\+|-|\*|\/
+ *   identifier  [a-z]+-?[a-z]+|[a-z]
+ */
+namespace {
+
+auto is_space(const char character) noexcept -> bool
+{
+  return std::isspace(static_cast<unsigned char>(character)) != 0;
+}
+
+auto is_digit(const char character) noexcept -> bool { return character >= '0' && character <= '9'; }
+
+auto is_letter(const char character) noexcept -> bool { return character >= 'a' && character <= 'z'; }
+
+auto scan_string(const std::string &input, const std::size_t position) noexcept -> std::size_t
+{
+  if (input[position] != '"') {
+    return position;
+  }
+  // An escaped quote normally continues the string, but if the string is never closed the last escaped quote is
+  // taken as the closing one instead (the same result the backtracking grammar gives).
+  auto last_escaped_quote = std::string::npos;
+  for (auto i = position + 1, j = input.size(); i < j; ++i) {
+    if (input[i] == '"') {
+      return i + 1;
+    }
+    if (input[i] == '\\' && i + 1 < j && input[i + 1] == '"') {
+      last_escaped_quote = ++i;
+    }
+  }
+  return last_escaped_quote != std::string::npos ? last_escaped_quote + 1 : position;
+}
+
+auto scan_number(const std::string &input, const std::size_t position) noexcept -> std::size_t
+{
+  auto i = position;
+  const auto j = input.size();
+  if (i < j && input[i] == '-') {
+    ++i;
+  }
+  if (i < j && input[i] == '.') {
+    ++i;
+  }
+  if (i == j || !is_digit(input[i])) {
+    return position;
+  }
+  while (i < j && is_digit(input[i])) {
+    ++i;
+  }
+  if (i < j && input[i] == '.') {
+    ++i;
+  }
+  while (i < j && is_digit(input[i])) {
+    ++i;
+  }
+  return i;
+}
+
+auto scan_boolean(const std::string &input, const std::size_t position) noexcept -> std::size_t
+{
+  if (position + 1 < input.size() && input[position] == '#' &&
+      (input[position + 1] == 't' || input[position + 1] == 'f')) {
+    return position + 2;
+  }
+  return position;
+}
+
+auto scan_nil(const std::string &input, const std::size_t position) noexcept -> std::size_t
+{
+  return input.compare(position, 3, "nil") == 0 ? position + 3 : position;
+}
+
+auto scan_operator(const std::string &input, const std::size_t position) noexcept -> std::size_t
+{
+  switch (input[position]) {
+  case '<':
+  case '>':
+    return position + 1 < input.size() && input[position + 1] == '=' ? position + 2 : position + 1;
+  case '=':
+  case '+':
+  case '-':
+  case '*':
+  case '/':
+    return position + 1;
+  default:
+    return position;
+  }
+}
+
+auto scan_identifier(const std::string &input, const std::size_t position) noexcept -> std::size_t
+{
+  auto i = position;
+  const auto j = input.size();
+  while (i < j && is_letter(input[i])) {
+    ++i;
+  }
+  if (i != position && i + 1 < j && input[i] == '-' && is_letter(input[i + 1])) {
+    ++i;
+    while (i < j && is_letter(input[i])) {
+      ++i;
+    }
+  }
+  return i;
+}
+
+} // namespace
+
+auto lexical_analysis(const std::string &input, const std::size_t first_line, const std::size_t first_column)
+    -> Token_list
 {
-  auto input_copy = input;
   auto token_list = Token_list();
-  auto match = std::smatch();
   auto left_parenthesis_count = 0;
   auto right_parenthesis_count = 0;
-  for (;;) {
-    if (input_copy.empty()) {
-      break;
+  auto position = std::size_t(0);
+  // Lines and columns count from 1, only whitespace and strings can hold a line break.
+  auto line = first_line;
+  auto line_start = std::size_t(0);
+  auto column_offset = first_column - 1;
+  const auto emit = [&](const Token_type token_type, const std::size_t end) {
+    token_list.emplace_back(
+        Token(token_type, input.substr(position, end - position), line, position - line_start + 1 + column_offset));
+    if (token_type == Token_type::string) {
+      for (auto i = position; i < end; ++i) {
+        if (input[i] == '\n') {
+          ++line;
+          line_start = i + 1;
+          column_offset = 0;
+        }
+      }
     }
-    if (std::regex_search(input_copy, match, std::regex(R"(\s|\t|\n|\r)")) && match.position() == 0) {
-      input_copy = match.suffix();
+    position = end;
+  };
+  for (auto end = std::size_t(0); position < input.size();) {
+    if (is_space(input[position])) {
+      if (input[position] == '\n') {
+        ++line;
+        line_start = position + 1;
+        column_offset = 0;
+      }
+      ++position;
       continue;
     }
-    if (std::regex_search(input_copy, match, std::regex(R"("(\\"|\\r|\\n|\\t|[^"])*")")) && match.position() == 0) {
-      token_list.emplace_back(Token(Token_type::string, match[0].str()));
-      input_copy = match.suffix();
+    if ((end = scan_string(input, position)) != position) {
+      emit(Token_type::string, end);
       continue;
     }
-    if (std::regex_search(input_copy, match, std::regex(R"(-?[.]?[0-9]+[.]?[0-9]*)")) && match.position() == 0) {
-      token_list.emplace_back(Token(Token_type::number, match[0].str()));
-      input_copy = match.suffix();
+    if ((end = scan_number(input, position)) != position) {
+      emit(Token_type::number, end);
       continue;
     }
-    if (std::regex_search(input_copy, match, std::regex(R"(#t|#f)")) && match.position() == 0) {
-      token_list.emplace_back(Token(Token_type::boolean, match[0].str()));
-      input_copy = match.suffix();
+    if ((end = scan_boolean(input, position)) != position) {
+      emit(Token_type::boolean, end);
       continue;
     }
-    if (std::regex_search(input_copy, match, std::regex(R"(nil)")) && match.position() == 0) {
-      token_list.emplace_back(Token(Token_type::nil, match[0].str()));
-      input_copy = match.suffix();
+    if ((end = scan_nil(input, position)) != position) {
+      emit(Token_type::nil, end);
       continue;
     }
-    if (std::regex_search(input_copy, match, std::regex(R"([(])")) && match.position() == 0) {
+    if (input[position] == '(') {
       ++left_parenthesis_count;
-      token_list.emplace_back(Token(Token_type::left_parenthesis, match[0].str()));
-      input_copy = match.suffix();
+      emit(Token_type::left_parenthesis, position + 1);
       continue;
     }
-    if (std::regex_search(input_copy, match, std::regex(R"([)])")) && match.position() == 0) {
+    if (input[position] == ')') {
       ++right_parenthesis_count;
-      token_list.emplace_back(Token(Token_type::right_parenthesis, match[0].str()));
-      input_copy = match.suffix();
+      emit(Token_type::right_parenthesis, position + 1);
       continue;
     }
-    if (std::regex_search(input_copy, match, std::regex(R"(<=|>=|<|>|=|\+|-|\*|\/)")) && match.position() == 0) {
-      token_list.emplace_back(Token(Token_type::identifier, match[0].str()));
-      input_copy = match.suffix();
+    if ((end = scan_operator(input, position)) != position) {
+      emit(Token_type::identifier, end);
       continue;
     }
-    if (std::regex_search(input_copy, match, std::regex(R"([a-z]+-?[a-z]+|[a-z])")) && match.position() == 0) {
-      token_list.emplace_back(Token(Token_type::identifier, match[0].str()));
-      input_copy = match.suffix();
+    if ((end = scan_identifier(input, position)) != position) {
+      emit(Token_type::identifier, end);
       continue;
     }
-    throw std::runtime_error("Syntax error occured: " + input_copy);
+    throw std::runtime_error("Syntax error occured: " + input.substr(position));
   }
   if (left_parenthesis_count != right_parenthesis_count) {
     throw std::runtime_error("For every '(' there must be a ')'.");
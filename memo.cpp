@@ -0,0 +1,241 @@
+#include "internal.hpp"
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+auto combine(const std::size_t seed, const std::size_t hash) noexcept -> std::size_t
+{
+  return seed ^ (hash + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+/*!
+ * \brief Hashes the arguments of a call by their structure (the contents of strings and lists, not their identity).
+ *        Returns false when an argument cannot be compared structurally (a function or a future), such a call is
+ *        not cached.
+ */
+auto hash_from(const Variant_list &arguments, std::size_t &hash) -> bool
+{
+  for (const auto &argument : arguments) {
+    hash = combine(hash, static_cast<std::size_t>(argument.type()));
+    switch (argument.type()) {
+    case Variant_type::nil:
+      break;
+    case Variant_type::number:
+      hash = combine(hash, std::hash<double>()(argument.number()));
+      break;
+    case Variant_type::integer:
+      hash = combine(hash, std::hash<std::int64_t>()(argument.integer()));
+      break;
+    case Variant_type::string: {
+      const auto &slice = argument.slice();
+      hash = combine(hash, hash_characters(slice.data(), slice.size()));
+      break;
+    }
+    case Variant_type::boolean:
+      hash = combine(hash, argument.boolean() ? 1 : 0);
+      break;
+    case Variant_type::list:
+      if (!hash_from(argument.list(), hash)) {
+        return false;
+      }
+      break;
+    case Variant_type::array:
+      for (const auto number : argument.array()) {
+        hash = combine(hash, std::hash<double>()(number));
+      }
+      break;
+    case Variant_type::function:
+    case Variant_type::future:
+      return false;
+    }
+  }
+  return true;
+}
+
+/*!
+ * \brief Compares arguments exactly. Variant equality treats numbers that are close enough as equal, which would
+ *        return the result of a call with different arguments.
+ */
+auto same(const Variant_list &left, const Variant_list &right) -> bool
+{
+  if (left.size() != right.size()) {
+    return false;
+  }
+  for (auto i = std::size_t(0), j = left.size(); i != j; ++i) {
+    if (left[i].type() != right[i].type()) {
+      return false;
+    }
+    switch (left[i].type()) {
+    case Variant_type::nil:
+      break;
+    case Variant_type::number: {
+      const auto left_number = left[i].number();
+      const auto right_number = right[i].number();
+      if (std::memcmp(&left_number, &right_number, sizeof(double)) != 0) {
+        return false;
+      }
+      break;
+    }
+    case Variant_type::integer:
+      if (left[i].integer() != right[i].integer()) {
+        return false;
+      }
+      break;
+    case Variant_type::string:
+      if (left[i].slice() != right[i].slice()) {
+        return false;
+      }
+      break;
+    case Variant_type::boolean:
+      if (left[i].boolean() != right[i].boolean()) {
+        return false;
+      }
+      break;
+    case Variant_type::list:
+      if (!same(left[i].list(), right[i].list())) {
+        return false;
+      }
+      break;
+    case Variant_type::array: {
+      const auto &left_array = left[i].array();
+      const auto &right_array = right[i].array();
+      if (left_array.size() != right_array.size() ||
+          std::memcmp(left_array.data(), right_array.data(), left_array.size() * sizeof(double)) != 0) {
+        return false;
+      }
+      break;
+    }
+    case Variant_type::function:
+    case Variant_type::future:
+      return false;
+    }
+  }
+  return true;
+}
+
+struct Arguments_hash final {
+  auto operator()(const std::pair<std::size_t, const Variant_list *> &key) const noexcept -> std::size_t
+  {
+    return key.first;
+  }
+};
+
+struct Arguments_equal final {
+  auto operator()(const std::pair<std::size_t, const Variant_list *> &left,
+                  const std::pair<std::size_t, const Variant_list *> &right) const -> bool
+  {
+    return left.first == right.first && same(*left.second, *right.second);
+  }
+};
+
+/*!
+ * \brief The results of a memo-lambda. The entries are kept in the order the eviction policy drops them from, last
+ *        first, and the index points into them by the hash and arguments of the call.
+ */
+struct Memo_cache final {
+  struct Entry final {
+    std::size_t hash;
+    Variant_list arguments;
+    Variant result;
+  };
+  using Key = std::pair<std::size_t, const Variant_list *>;
+
+  explicit Memo_cache(const Memo_options &options) : options(options) {}
+
+  std::mutex mutex;
+  Memo_options options;
+  std::list<Entry> entries = std::list<Entry>();
+  std::unordered_map<Key, std::list<Entry>::iterator, Arguments_hash, Arguments_equal> index =
+      std::unordered_map<Key, std::list<Entry>::iterator, Arguments_hash, Arguments_equal>();
+  Memo_statistics statistics = Memo_statistics();
+};
+
+/*!
+ * \brief The function object behind a memo-lambda, it calls the lambda on a miss. The cache is not locked during
+ *        the call, which can (and for recursive definitions does) call the memo-lambda again.
+ */
+struct Memo_function final {
+  Variant function;
+  std::shared_ptr<Memo_cache> cache;
+
+  auto operator()(Environment environment, const Variant_list &arguments) const -> Variant
+  {
+    auto hash = std::size_t(0);
+    if (!hash_from(arguments, hash) || cache->options.capacity == 0) {
+      return function.function()(std::move(environment), arguments);
+    }
+    const auto key = Memo_cache::Key(hash, &arguments);
+    {
+      std::lock_guard<std::mutex> lock(cache->mutex);
+      const auto found = cache->index.find(key);
+      if (found != std::end(cache->index)) {
+        ++cache->statistics.hits;
+        if (cache->options.eviction == Memo_eviction::least_recently_used) {
+          cache->entries.splice(std::begin(cache->entries), cache->entries, found->second);
+        }
+        return found->second->result;
+      }
+      ++cache->statistics.misses;
+    }
+    auto result = function.function()(std::move(environment), arguments);
+    std::lock_guard<std::mutex> lock(cache->mutex);
+    if (cache->index.find(key) == std::end(cache->index)) {
+      cache->entries.push_front(Memo_cache::Entry{hash, arguments, result});
+      cache->index.emplace(Memo_cache::Key(hash, &cache->entries.front().arguments), std::begin(cache->entries));
+      if (cache->entries.size() > cache->options.capacity) {
+        const auto &last = cache->entries.back();
+        cache->index.erase(Memo_cache::Key(last.hash, &last.arguments));
+        cache->entries.pop_back();
+        ++cache->statistics.evictions;
+      }
+      cache->statistics.size = cache->entries.size();
+    }
+    return result;
+  }
+};
+
+struct Memo_defaults final {
+  std::mutex mutex;
+  Memo_options options = Memo_options{1024, Memo_eviction::least_recently_used};
+};
+
+auto memo_defaults() -> Memo_defaults &
+{
+  static Memo_defaults defaults;
+  return defaults;
+}
+
+} // namespace
+
+auto memoize(Variant function) -> Variant
+{
+  auto &defaults = memo_defaults();
+  auto options = Memo_options();
+  {
+    std::lock_guard<std::mutex> lock(defaults.mutex);
+    options = defaults.options;
+  }
+  auto cache = std::make_shared<Memo_cache>(options);
+  cache->statistics.capacity = options.capacity;
+  return Variant(Variant_function(Memo_function{std::move(function), std::move(cache)}));
+}
+
+auto set_memo_options(const Memo_options &options) -> void
+{
+  auto &defaults = memo_defaults();
+  std::lock_guard<std::mutex> lock(defaults.mutex);
+  defaults.options = options;
+}
+
+auto memo_statistics(const Variant &function) -> Memo_statistics
+{
+  const auto memo_function = function.function().target<Memo_function>();
+  if (!memo_function) {
+    throw std::runtime_error("Function is not a memo-lambda.");
+  }
+  std::lock_guard<std::mutex> lock(memo_function->cache->mutex);
+  return memo_function->cache->statistics;
+}
@@ -0,0 +1,95 @@
+#include "internal.hpp"
+#include <iostream>
+#include <mutex>
+
+Output_sink::~Output_sink() noexcept = default;
+
+auto Output_sink::flush() -> void {}
+
+struct Buffered_output::Impl final {
+  std::mutex mutex;
+  std::ostream *stream;
+  Output_options options;
+  std::string buffer = std::string();
+
+  /*!
+   * \brief Writes the buffer out, with the lock held.
+   */
+  auto drain() -> void
+  {
+    stream->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    stream->flush();
+    buffer.clear();
+  }
+};
+
+Buffered_output::Buffered_output(std::ostream &stream, const Output_options &options)
+    : impl(std::make_shared<Impl>())
+{
+  impl->stream = &stream;
+  impl->options = options;
+  impl->buffer.reserve(options.batch_size);
+}
+
+Buffered_output::~Buffered_output() noexcept
+{
+  try {
+    flush();
+  }
+  catch (...) {
+    // A stream that throws on write has nowhere left to report to.
+  }
+}
+
+auto Buffered_output::write(const std::string &line) -> void
+{
+  std::lock_guard<std::mutex> lock(impl->mutex);
+  impl->buffer += line;
+  impl->buffer += '\n';
+  if (impl->options.flush_policy == Flush_policy::every_line || impl->buffer.size() >= impl->options.batch_size) {
+    impl->drain();
+  }
+}
+
+auto Buffered_output::flush() -> void
+{
+  std::lock_guard<std::mutex> lock(impl->mutex);
+  if (!impl->buffer.empty()) {
+    impl->drain();
+  }
+}
+
+namespace {
+
+struct Standard_output final {
+  std::mutex mutex;
+  Output sink = std::make_shared<Buffered_output>(std::cout);
+};
+
+auto standard_output_state() -> Standard_output &
+{
+  // Made after std::cout, so it is destroyed (and flushed) before it.
+  static Standard_output state;
+  return state;
+}
+
+} // namespace
+
+auto standard_output() -> Output
+{
+  auto &state = standard_output_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  return state.sink;
+}
+
+auto set_standard_output(Output sink) -> void
+{
+  auto &state = standard_output_state();
+  auto previous = Output();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    previous = std::move(state.sink);
+    state.sink = sink ? std::move(sink) : std::make_shared<Buffered_output>(std::cout);
+  }
+  previous->flush();
+}
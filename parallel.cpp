@@ -0,0 +1,319 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+using Task = std::function<void()>;
+
+/*!
+ * \brief The tasks waiting on one worker. The worker takes its newest task first, the others steal the oldest.
+ *        Aligned so the queues of two workers never share a cache line.
+ */
+struct alignas(64) Task_queue final {
+  std::mutex mutex;
+  std::deque<Task> tasks = std::deque<Task>();
+};
+
+/*!
+ * \brief A work stealing thread pool. A task submitted on a worker goes to that worker's queue, anything else is
+ *        dealt round robin. A worker with nothing in its own queue steals from the others, and only sleeps when
+ *        every queue is empty.
+ */
+class Thread_pool final {
+public:
+  explicit Thread_pool(const std::size_t size);
+  ~Thread_pool() noexcept;
+
+  Thread_pool(const Thread_pool &) = delete;
+  Thread_pool(Thread_pool &&) = delete;
+  Thread_pool &operator=(const Thread_pool &) = delete;
+  Thread_pool &operator=(Thread_pool &&) = delete;
+
+  auto submit(Task task) -> void;
+
+  /*!
+   * \brief Runs one waiting task on the calling thread, returns false when there was none.
+   */
+  auto run_one() -> bool;
+
+private:
+  auto take(const std::size_t index, const bool newest) -> Task;
+  auto work(const std::size_t index) -> void;
+
+  std::vector<std::unique_ptr<Task_queue>> queues = std::vector<std::unique_ptr<Task_queue>>();
+  std::atomic<std::size_t> queued = {0};
+  std::atomic<std::size_t> next = {0};
+  std::mutex mutex;
+  std::condition_variable tasks_added;
+  bool stopping = false;
+  char padding[7] = {0};
+  std::vector<std::thread> threads = std::vector<std::thread>();
+};
+
+/*!
+ * \brief The pool the calling thread works for and its queue there, if it is a worker.
+ */
+thread_local Thread_pool *worker_pool = nullptr;
+thread_local auto worker_index = std::size_t(0);
+
+Thread_pool::Thread_pool(const std::size_t size)
+{
+  for (auto i = std::size_t(0); i != size; ++i) {
+    queues.emplace_back(std::make_unique<Task_queue>());
+  }
+  for (auto i = std::size_t(0); i != size; ++i) {
+    threads.emplace_back([this, i] { work(i); });
+  }
+}
+
+Thread_pool::~Thread_pool() noexcept
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  tasks_added.notify_all();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+auto Thread_pool::submit(Task task) -> void
+{
+  const auto index = worker_pool == this ? worker_index : next++ % queues.size();
+  {
+    std::lock_guard<std::mutex> lock(queues[index]->mutex);
+    queues[index]->tasks.emplace_back(std::move(task));
+  }
+  ++queued;
+  // Taking the lock orders this with a worker that is about to sleep, so it either sees the task or gets woken.
+  { std::lock_guard<std::mutex> lock(mutex); }
+  tasks_added.notify_one();
+}
+
+auto Thread_pool::take(const std::size_t index, const bool newest) -> Task
+{
+  auto &queue = *queues[index];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty()) {
+    return Task();
+  }
+  auto task = Task();
+  if (newest) {
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+  }
+  else {
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+  }
+  --queued;
+  return task;
+}
+
+auto Thread_pool::run_one() -> bool
+{
+  if (queued.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+  const auto own = worker_pool == this;
+  const auto first = own ? worker_index : next.load(std::memory_order_relaxed);
+  auto task = own ? take(first, true) : Task();
+  for (auto i = std::size_t(0), j = queues.size(); !task && i != j; ++i) {
+    task = take((first + i) % j, false);
+  }
+  if (!task) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+auto Thread_pool::work(const std::size_t index) -> void
+{
+  worker_pool = this;
+  worker_index = index;
+  for (;;) {
+    if (run_one()) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    tasks_added.wait(lock, [this] { return stopping || queued != 0; });
+    if (stopping) {
+      return;
+    }
+  }
+}
+
+struct Thread_pool_state final {
+  std::mutex mutex;
+  std::size_t size = std::max(std::thread::hardware_concurrency(), 1u);
+  std::shared_ptr<Thread_pool> pool = nullptr;
+};
+
+auto thread_pool_state() -> Thread_pool_state &
+{
+  static Thread_pool_state state;
+  return state;
+}
+
+/*!
+ * \brief Returns the pool, started on first use, or nullptr when the tasks run on the calling thread alone.
+ */
+auto thread_pool() -> std::shared_ptr<Thread_pool>
+{
+  auto &state = thread_pool_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  if (!state.pool && state.size > 1) {
+    // The thread waiting for the tasks runs them as well, it counts as one of the threads.
+    state.pool = std::make_shared<Thread_pool>(state.size - 1);
+  }
+  return state.pool;
+}
+
+/*!
+ * \brief The tasks of one parallel form that have not finished yet.
+ */
+struct Batch final {
+  std::mutex mutex;
+  std::condition_variable finished;
+  std::size_t remaining;
+};
+
+/*!
+ * \brief Runs task(0) to task(count - 1) on the pool and returns their results in order. The calling thread runs
+ *        tasks (of this or any other form) while it waits, so forms nested in the tasks never wait on a pool with
+ *        every worker blocked. All the tasks run even when some throw, then the first exception (in order) is
+ *        rethrown.
+ */
+auto run_parallel(const std::size_t count, const std::function<Variant(std::size_t)> &task) -> Variant_list
+{
+  auto results = Variant_list(count);
+  auto errors = std::vector<std::exception_ptr>(count);
+  const auto run = [&](const std::size_t i) {
+    try {
+      results[i] = task(i);
+    }
+    catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+  // A worker hands nested forms to its own pool (which might not be the current one, after a resize).
+  auto pool = std::shared_ptr<Thread_pool>();
+  auto pool_pointer = worker_pool;
+  if (!pool_pointer && count > 1) {
+    pool = thread_pool();
+    pool_pointer = pool.get();
+  }
+  if (!pool_pointer || count < 2) {
+    for (auto i = std::size_t(0); i != count; ++i) {
+      run(i);
+    }
+  }
+  else {
+    Batch batch;
+    batch.remaining = count - 1;
+    // Submitted last to first, so the worker that owns the queue takes them first to last.
+    for (auto i = count - 1; i != 0; --i) {
+      pool_pointer->submit([&run, &batch, i] {
+        run(i);
+        std::lock_guard<std::mutex> lock(batch.mutex);
+        if (--batch.remaining == 0) {
+          batch.finished.notify_all();
+        }
+      });
+    }
+    run(0);
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> lock(batch.mutex);
+        if (batch.remaining == 0) {
+          break;
+        }
+      }
+      if (!pool_pointer->run_one()) {
+        // Tasks still running can submit more, so the wait is short and the queues are checked again after it.
+        std::unique_lock<std::mutex> lock(batch.mutex);
+        batch.finished.wait_for(lock, std::chrono::microseconds(100), [&batch] { return batch.remaining == 0; });
+      }
+    }
+  }
+  for (const auto &error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  return results;
+}
+
+} // namespace
+
+auto parallel_call(Environment environment, const Variant_list &functions) -> Variant
+{
+  return Variant(run_parallel(functions.size(), [&](const std::size_t i) {
+    return functions[i].function()(environment, empty_variant_list);
+  }));
+}
+
+auto parallel_map(Environment environment, const Variant &function, const Variant &list) -> Variant
+{
+  const auto &callee = function.function();
+  const auto &items = list.list();
+  return Variant(run_parallel(items.size(), [&](const std::size_t i) {
+    Pooled_arguments arguments;
+    arguments.values.emplace_back(items[i]);
+    return callee(environment, arguments.values);
+  }));
+}
+
+auto submit_to_thread_pool(std::function<void()> task) -> bool
+{
+  if (worker_pool) {
+    worker_pool->submit(std::move(task));
+    return true;
+  }
+  const auto pool = thread_pool();
+  if (!pool) {
+    return false;
+  }
+  pool->submit(std::move(task));
+  return true;
+}
+
+auto help_thread_pool() -> bool
+{
+  if (worker_pool) {
+    return worker_pool->run_one();
+  }
+  auto &state = thread_pool_state();
+  auto pool = std::shared_ptr<Thread_pool>();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    pool = state.pool;
+  }
+  return pool && pool->run_one();
+}
+
+auto set_thread_pool_size(const std::size_t size) -> void
+{
+  auto &state = thread_pool_state();
+  auto pool = std::shared_ptr<Thread_pool>();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.size = std::max(size, std::size_t(1));
+    pool = std::move(state.pool);
+  }
+  // Forms still running keep the old pool until they finish, the last one stops its threads.
+}
+
+auto thread_pool_size() -> std::size_t
+{
+  auto &state = thread_pool_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  return state.size;
+}
@@ -1,117 +1,170 @@
 #include "internal.hpp"
+#include <stdexcept>
 
-auto parse_begin_from(Token_list &token_list) -> AST
+auto parse_begin_from(Token_cursor &token_cursor) -> AST
 {
-  auto token = consume_from(token_list);
+  consume_from(token_cursor);
   auto ast_list = AST_list();
-  while (token_list.front().type() != Token_type::right_parenthesis) {
-    ast_list.emplace_back(parse_from(token_list));
+  while (peek_from(token_cursor).type() != Token_type::right_parenthesis) {
+    ast_list.emplace_back(parse_from(token_cursor));
   }
-  consume_from(token_list);
+  consume_from(token_cursor);
   return List(ast_list).clone();
 }
 
-auto parse_lambda_from(Token_list &token_list) -> AST
+auto parse_lambda_from(Token_cursor &token_cursor, const bool memoized) -> AST
 {
-  auto token = consume_from(token_list);
+  const auto &token = consume_from(token_cursor);
+  // Named after where it is written, unless it is set to a variable (see parse_set_from).
+  auto name = profile_name("lambda@" + std::to_string(token.line()) + ":" + std::to_string(token.column()));
   auto parameters = Token_list();
-  consume_from(token_list);
-  while (token_list.front().type() != Token_type::right_parenthesis) {
-    parameters.emplace_back(consume_from(token_list));
-  }
-  if (consume_from(token_list).type() != Token_type::right_parenthesis) {
+  if (consume_from(token_cursor).type() != Token_type::left_parenthesis) {
     throw std::runtime_error("Syntax error.");
   }
-  auto body = parse_from(token_list);
-  if (consume_from(token_list).type() != Token_type::right_parenthesis) {
+  while (peek_from(token_cursor).type() != Token_type::right_parenthesis) {
+    parameters.emplace_back(consume_from(token_cursor));
+  }
+  consume_from(token_cursor);
+  auto body = parse_from(token_cursor);
+  if (consume_from(token_cursor).type() != Token_type::right_parenthesis) {
     throw std::runtime_error("Syntax error.");
   }
-  return Lambda(parameters, body).clone();
+  return Lambda(parameters, body, std::move(name), memoized).clone();
 }
 
-auto parse_if_from(Token_list &token_list) -> AST
+auto parse_if_from(Token_cursor &token_cursor) -> AST
 {
-  auto token = consume_from(token_list);
-  auto test = parse_from(token_list);
-  auto consequent = parse_from(token_list);
-  auto alternate = parse_from(token_list);
-  if (consume_from(token_list).type() != Token_type::right_parenthesis) {
+  consume_from(token_cursor);
+  auto test = parse_from(token_cursor);
+  auto consequent = parse_from(token_cursor);
+  auto alternate = parse_from(token_cursor);
+  if (consume_from(token_cursor).type() != Token_type::right_parenthesis) {
     throw std::runtime_error("Syntax error.");
   }
   return If(test, consequent, alternate).clone();
 }
 
-auto parse_set_from(Token_list &token_list) -> AST
+auto parse_set_from(Token_cursor &token_cursor) -> AST
 {
-  auto token = consume_from(token_list);
-  auto identifier = consume_from(token_list);
-  auto value = parse_from(token_list);
-  if (consume_from(token_list).type() != Token_type::right_parenthesis) {
+  consume_from(token_cursor);
+  auto identifier = consume_from(token_cursor);
+  auto value = parse_from(token_cursor);
+  if (consume_from(token_cursor).type() != Token_type::right_parenthesis) {
     throw std::runtime_error("Syntax error.");
   }
+  if (const auto lambda = std::dynamic_pointer_cast<const Lambda>(value)) {
+    value = lambda->named(profile_name(identifier.value()));
+  }
   return Set(identifier, value).clone();
 }
 
-auto parse_operation_from(Token_list &token_list) -> AST
+auto parse_parallel_begin_from(Token_cursor &token_cursor) -> AST
+{
+  const auto &token = consume_from(token_cursor);
+  auto name = profile_name("parallel-begin@" + std::to_string(token.line()) + ":" + std::to_string(token.column()));
+  auto thunks = AST_list();
+  while (peek_from(token_cursor).type() != Token_type::right_parenthesis) {
+    thunks.emplace_back(Lambda(Token_list(), parse_from(token_cursor), name).clone());
+  }
+  consume_from(token_cursor);
+  return Parallel_begin(List(thunks).clone()).clone();
+}
+
+auto parse_future_from(Token_cursor &token_cursor) -> AST
+{
+  const auto &token = consume_from(token_cursor);
+  auto name = profile_name("future@" + std::to_string(token.line()) + ":" + std::to_string(token.column()));
+  auto expression = parse_from(token_cursor);
+  if (consume_from(token_cursor).type() != Token_type::right_parenthesis) {
+    throw std::runtime_error("Syntax error.");
+  }
+  return Future_form(Lambda(Token_list(), expression, std::move(name)).clone()).clone();
+}
+
+auto parse_operation_from(Token_cursor &token_cursor) -> AST
 {
-  auto token = consume_from(token_list);
-  auto left = parse_from(token_list);
-  auto right = parse_from(token_list);
-  if (consume_from(token_list).type() != Token_type::right_parenthesis) {
+  auto token = consume_from(token_cursor);
+  auto left = parse_from(token_cursor);
+  auto right = parse_from(token_cursor);
+  if (consume_from(token_cursor).type() != Token_type::right_parenthesis) {
     throw std::runtime_error("Syntax error.");
   }
-  return Operator(token, left, right).clone();
+  return operator_from(token, left, right);
 }
 
-auto parse_print_line_from(Token_list &token_list) -> AST
+auto parse_unary_operation_from(Token_cursor &token_cursor) -> AST
 {
-  auto token = consume_from(token_list);
-  auto parameter = parse_from(token_list);
-  if (consume_from(token_list).type() != Token_type::right_parenthesis) {
+  auto token = consume_from(token_cursor);
+  auto operand = parse_from(token_cursor);
+  if (consume_from(token_cursor).type() != Token_type::right_parenthesis) {
+    throw std::runtime_error("Syntax error.");
+  }
+  return unary_operator_from(token, operand);
+}
+
+auto parse_print_line_from(Token_cursor &token_cursor) -> AST
+{
+  consume_from(token_cursor);
+  auto parameter = parse_from(token_cursor);
+  if (consume_from(token_cursor).type() != Token_type::right_parenthesis) {
     throw std::runtime_error("Syntax error.");
   }
   return Print_line(parameter).clone();
 }
 
-auto parse_procedure_from(Token_list &token_list) -> AST
+auto parse_procedure_from(Token_cursor &token_cursor) -> AST
 {
-  auto token = consume_from(token_list);
+  auto token = consume_from(token_cursor);
   auto ast_list = AST_list();
-  while (token_list.front().type() != Token_type::right_parenthesis) {
-    ast_list.emplace_back(parse_from(token_list));
+  while (peek_from(token_cursor).type() != Token_type::right_parenthesis) {
+    ast_list.emplace_back(parse_from(token_cursor));
   }
-  consume_from(token_list);
+  consume_from(token_cursor);
   auto arguments = List(ast_list).clone();
   return Procedure(token, arguments).clone();
 }
 
-auto parse_from(Token_list &token_list) -> AST
+auto parse_from(Token_cursor &token_cursor) -> AST
 {
-  if (token_list.front().type() == Token_type::left_parenthesis) {
-    consume_from(token_list);
-    const auto &identifier = token_list.front().value();
+  if (peek_from(token_cursor).type() == Token_type::left_parenthesis) {
+    consume_from(token_cursor);
+    const auto &identifier = peek_from(token_cursor).value();
     if (identifier == "begin") {
-      return parse_begin_from(token_list);
+      return parse_begin_from(token_cursor);
     }
     if (identifier == "lambda") {
-      return parse_lambda_from(token_list);
+      return parse_lambda_from(token_cursor, false);
+    }
+    if (identifier == "memo-lambda") {
+      return parse_lambda_from(token_cursor, true);
     }
     if (identifier == "if") {
-      return parse_if_from(token_list);
+      return parse_if_from(token_cursor);
     }
     if (identifier == "set") {
-      return parse_set_from(token_list);
+      return parse_set_from(token_cursor);
+    }
+    if (identifier == "parallel-begin") {
+      return parse_parallel_begin_from(token_cursor);
+    }
+    if (identifier == "future") {
+      return parse_future_from(token_cursor);
     }
     if (identifier == "+" || identifier == "-" || identifier == "*" || identifier == "/" || identifier == "<" ||
-        identifier == ">" || identifier == "<=" || identifier == ">=" || identifier == "=") {
-      return parse_operation_from(token_list);
+        identifier == ">" || identifier == "<=" || identifier == ">=" || identifier == "=" ||
+        identifier == "array-dot") {
+      return parse_operation_from(token_cursor);
+    }
+    if (identifier == "array-from" || identifier == "array-sum" || identifier == "array-min" ||
+        identifier == "array-max") {
+      return parse_unary_operation_from(token_cursor);
     }
     if (identifier == "print-line") {
-      return parse_print_line_from(token_list);
+      return parse_print_line_from(token_cursor);
     }
-    return parse_procedure_from(token_list);
+    return parse_procedure_from(token_cursor);
   }
-  auto token = consume_from(token_list);
+  const auto &token = consume_from(token_cursor);
   if (token.type() == Token_type::identifier) {
     return Variable(token).clone();
   }
@@ -121,3 +174,9 @@ auto parse_from(Token_list &token_list) -> AST
   }
   throw std::runtime_error("Unknown token type.");
 }
+
+auto parse_from(const Token_list &token_list) -> AST
+{
+  auto token_cursor = cursor_from(token_list);
+  return parse_from(token_cursor);
+}
@@ -0,0 +1,212 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+std::atomic<bool> profiler_running(false);
+
+namespace {
+
+/*!
+ * \brief The names of the lambdas a thread is calling, outermost first, published for the timer thread to read.
+ *        Only the owning thread writes it, under a sequence lock: the sequence is odd while a change is being made,
+ *        and the timer copies the stack again when the sequence it read before and after the copy differ. Names
+ *        are freed with the profiler's lock held (see profile_name), which the timer holds while it copies, and a
+ *        name is off the stack before the lambda it belongs to can be freed. A stack deeper than the capacity keeps
+ *        its depth but only the outermost names.
+ */
+static constexpr auto stack_capacity = std::size_t(1024);
+
+struct Thread_stack final {
+  std::atomic<std::size_t> sequence = {0};
+  std::atomic<std::size_t> depth = {0};
+  std::atomic<const std::string *> names[stack_capacity];
+
+  /*!
+   * \brief Runs a change of the stack between the two increments of the sequence.
+   */
+  template <typename Change> auto write(const Change &change) noexcept -> void
+  {
+    const auto count = sequence.load(std::memory_order_relaxed);
+    sequence.store(count + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    change();
+    sequence.store(count + 2, std::memory_order_release);
+  }
+
+  /*!
+   * \brief Copies the stack in folded form ("outer;inner"), or returns false when the owning thread kept changing
+   *        it. The empty stack gives an empty string.
+   */
+  auto read(std::string &stack) const -> bool
+  {
+    for (auto attempt = 0; attempt != 16; ++attempt) {
+      stack.clear();
+      const auto before = sequence.load(std::memory_order_acquire);
+      if (before % 2 != 0) {
+        continue;
+      }
+      const auto size = depth.load(std::memory_order_relaxed);
+      for (auto i = std::size_t(0), j = std::min(size, stack_capacity); i != j; ++i) {
+        if (!stack.empty()) {
+          stack += ';';
+        }
+        stack += *names[i].load(std::memory_order_relaxed);
+      }
+      if (size > stack_capacity) {
+        stack += ";...";
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == before) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+/*!
+ * \brief The state of the profiler. Every thread that enters a lambda while the profiler runs registers its stack,
+ *        and after every interval the timer thread records the stack of each registered thread that is inside one.
+ */
+struct Profiler final {
+  std::mutex mutex;
+  std::condition_variable stopping_changed;
+  bool stopping = false;
+  char padding[7] = {0};
+  std::thread timer = std::thread();
+  std::vector<std::weak_ptr<const Thread_stack>> stacks = std::vector<std::weak_ptr<const Thread_stack>>();
+  std::map<std::string, std::size_t> samples = std::map<std::string, std::size_t>();
+
+  /*!
+   * \brief Records the stack of every thread, weighted by the number of intervals since the last time, with the
+   *        lock held. Threads that have ended are dropped.
+   */
+  auto sample(const std::size_t ticks) -> void;
+};
+
+auto Profiler::sample(const std::size_t ticks) -> void
+{
+  auto stack = std::string();
+  for (auto i = std::begin(stacks); i != std::end(stacks);) {
+    const auto thread_stack = i->lock();
+    if (!thread_stack) {
+      i = stacks.erase(i);
+      continue;
+    }
+    if (thread_stack->read(stack) && !stack.empty()) {
+      samples[stack] += ticks;
+    }
+    ++i;
+  }
+}
+
+auto profiler() -> Profiler &
+{
+  static Profiler profiler;
+  return profiler;
+}
+
+/*!
+ * \brief The stack of this thread, registered with the profiler the first time it is needed.
+ */
+auto thread_stack() -> Thread_stack &
+{
+  thread_local const auto stack = [] {
+    auto created = std::make_shared<Thread_stack>();
+    auto &state = profiler();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.stacks.emplace_back(created);
+    return created;
+  }();
+  return *stack;
+}
+
+} // namespace
+
+auto profile_name(std::string name) -> Profile_name
+{
+  // A lambda can be freed while the timer copies a stack its name is still on, its name is not freed until the copy
+  // is done. Making the profiler first also has it outlive every name.
+  auto &state = profiler();
+  return Profile_name(new const std::string(std::move(name)), [&state](const std::string *freed) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    delete freed;
+  });
+}
+
+auto push_profile_frame(const std::string &name) -> void
+{
+  auto &stack = thread_stack();
+  const auto depth = stack.depth.load(std::memory_order_relaxed);
+  stack.write([&stack, &name, depth] {
+    if (depth < stack_capacity) {
+      stack.names[depth].store(&name, std::memory_order_relaxed);
+    }
+    stack.depth.store(depth + 1, std::memory_order_relaxed);
+  });
+}
+
+auto pop_profile_frame() noexcept -> void
+{
+  auto &stack = thread_stack();
+  const auto depth = stack.depth.load(std::memory_order_relaxed);
+  stack.write([&stack, depth] { stack.depth.store(depth - 1, std::memory_order_relaxed); });
+}
+
+auto replace_profile_frame(const std::string &name) -> void
+{
+  auto &stack = thread_stack();
+  const auto depth = stack.depth.load(std::memory_order_relaxed);
+  if (depth <= stack_capacity) {
+    stack.write([&stack, &name, depth] { stack.names[depth - 1].store(&name, std::memory_order_relaxed); });
+  }
+}
+
+auto start_profiler(const std::chrono::microseconds interval) -> void
+{
+  auto &state = profiler();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  if (state.timer.joinable()) {
+    throw std::runtime_error("The profiler is already running.");
+  }
+  state.stopping = false;
+  state.samples.clear();
+  state.timer = std::thread([&state, interval] {
+    std::unique_lock<std::mutex> timer_lock(state.mutex);
+    auto last = std::chrono::steady_clock::now();
+    while (!state.stopping_changed.wait_for(timer_lock, interval, [&state] { return state.stopping; })) {
+      // A timer that woke up late counts the intervals it missed, rather than losing them.
+      const auto now = std::chrono::steady_clock::now();
+      const auto ticks = std::max(std::chrono::microseconds::rep(1),
+                                  std::chrono::duration_cast<std::chrono::microseconds>(now - last).count() /
+                                      std::max(interval.count(), std::chrono::microseconds::rep(1)));
+      last += interval * ticks;
+      state.sample(static_cast<std::size_t>(ticks));
+    }
+  });
+  profiler_running = true;
+}
+
+auto stop_profiler() -> std::string
+{
+  auto &state = profiler();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (!state.timer.joinable()) {
+      throw std::runtime_error("The profiler is not running.");
+    }
+    profiler_running = false;
+    state.stopping = true;
+  }
+  state.stopping_changed.notify_one();
+  state.timer.join();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto folded = std::string();
+  for (const auto &stack : state.samples) {
+    folded += stack.first + " " + std::to_string(stack.second) + "\n";
+  }
+  return folded;
+}
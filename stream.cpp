@@ -0,0 +1,160 @@
+#include "internal.hpp"
+#include <algorithm>
+#include <cctype>
+#include <istream>
+
+/*
+ * The stream interpreter only finds where each top level form ends, the form itself is lexed and parsed as a whole
+ * once it is complete. To find the end it keeps, across chunks, how deep the form is nested and whether it is inside
+ * a string, with the lexer's rule that a quote right after a backslash does not close the string. Whitespace between
+ * forms is dropped as it is read, so nothing outlives the form it belongs to.
+ */
+struct Stream_interpreter::Impl final {
+  Environment environment;
+  Engine engine;
+  // The input not looked at yet, which is only left over when a form threw.
+  std::string pending = std::string();
+  // The form being read, and the line and column it starts at.
+  std::string form = std::string();
+  std::size_t form_line = 1;
+  std::size_t form_column = 1;
+  // The line and column of the next character.
+  std::size_t line = 1;
+  std::size_t column = 1;
+  std::size_t depth = 0;
+  bool in_string = false;
+  bool escaped = false;
+  char padding[6] = {0};
+
+  auto execute_form() -> Variant;
+};
+
+auto Stream_interpreter::Impl::execute_form() -> Variant
+{
+  // Taken out first, so a form that throws is not run again.
+  const auto input = std::move(form);
+  form = std::string();
+  depth = 0;
+  in_string = false;
+  escaped = false;
+  return Program(input, form_line, form_column).execute(environment, engine);
+}
+
+Stream_interpreter::Stream_interpreter(Environment environment, const Engine engine)
+    : impl(std::make_shared<Impl>())
+{
+  impl->environment = std::move(environment);
+  impl->engine = engine;
+}
+
+auto Stream_interpreter::feed(const std::string &chunk) -> Variant_list
+{
+  auto &state = *impl;
+  auto values = Variant_list();
+  auto input = std::move(state.pending);
+  input += chunk;
+  state.pending = std::string();
+  auto position = std::size_t(0);
+  const auto execute_form = [&] {
+    try {
+      values.emplace_back(state.execute_form());
+    }
+    catch (...) {
+      state.pending = input.substr(position);
+      throw;
+    }
+  };
+  while (position < input.size()) {
+    const auto character = input[position];
+    const auto in_atom = state.depth == 0 && !state.in_string && !state.form.empty();
+    const auto space = std::isspace(static_cast<unsigned char>(character)) != 0;
+    if (in_atom && (space || character == '(' || character == ')' || character == '"')) {
+      // The character ends the atom without being part of it, it is looked at again for the next form.
+      execute_form();
+      continue;
+    }
+    ++position;
+    if (character == '\n') {
+      ++state.line;
+      state.column = 1;
+    }
+    else {
+      ++state.column;
+    }
+    if (state.form.empty()) {
+      if (space) {
+        continue;
+      }
+      if (character == ')') {
+        state.pending = input.substr(position);
+        throw std::runtime_error("For every '(' there must be a ')'.");
+      }
+      state.form_line = state.line;
+      state.form_column = state.column - 1;
+    }
+    state.form += character;
+    auto complete = false;
+    if (state.in_string) {
+      if (character == '"' && !state.escaped) {
+        state.in_string = false;
+        complete = state.depth == 0;
+      }
+      state.escaped = character == '\\';
+    }
+    else if (character == '"') {
+      state.in_string = true;
+      state.escaped = false;
+    }
+    else if (character == '(') {
+      ++state.depth;
+    }
+    else if (character == ')') {
+      complete = --state.depth == 0;
+    }
+    if (complete) {
+      execute_form();
+    }
+  }
+  return values;
+}
+
+auto Stream_interpreter::finish() -> Variant_list
+{
+  auto values = feed(std::string());
+  if (!impl->form.empty()) {
+    values.emplace_back(impl->execute_form());
+  }
+  return values;
+}
+
+auto interpret(Environment environment, std::istream &input, const Engine engine) -> Variant
+{
+  static constexpr auto chunk_size = std::streamsize(4096);
+  auto interpreter = Stream_interpreter(std::move(environment), engine);
+  auto value = Variant();
+  const auto keep_last = [&value](const Variant_list &values) {
+    if (!values.empty()) {
+      value = values.back();
+    }
+  };
+  auto chunk = std::string();
+  for (;;) {
+    // Whatever is buffered is taken at once, otherwise a single character is waited for.
+    const auto available = input.rdbuf()->in_avail();
+    if (available > 0) {
+      chunk.resize(static_cast<std::size_t>(std::min(available, chunk_size)));
+      input.read(&chunk[0], static_cast<std::streamsize>(chunk.size()));
+      chunk.resize(static_cast<std::size_t>(input.gcount()));
+    }
+    else {
+      const auto character = input.get();
+      if (character == std::istream::traits_type::eof()) {
+        break;
+      }
+      chunk.assign(1, static_cast<char>(character));
+    }
+    keep_last(interpreter.feed(chunk));
+  }
+  keep_last(interpreter.finish());
+  return value;
+}
@@ -0,0 +1,47 @@
+#include "wlisp.hpp"
+#include <mutex>
+#include <unordered_set>
+
+namespace {
+
+/*!
+ * \brief The global symbol table. Names are never removed, and the nodes of an unordered_set keep their address
+ *        when it rehashes, so a Symbol can point straight at its name.
+ */
+struct Symbol_table final {
+  std::mutex mutex;
+  std::unordered_set<std::string> names = std::unordered_set<std::string>();
+};
+
+auto symbol_table() -> Symbol_table &
+{
+  static Symbol_table table;
+  return table;
+}
+
+} // namespace
+
+Symbol::Symbol()
+{
+  static const auto empty = Symbol(std::string());
+  entry = empty.entry;
+}
+
+Symbol::Symbol(const std::string &name)
+{
+  auto &table = symbol_table();
+  std::lock_guard<std::mutex> lock(table.mutex);
+  entry = &*table.names.insert(name).first;
+}
+
+auto find_symbol(const std::string &name, Symbol &symbol) -> bool
+{
+  auto &table = symbol_table();
+  std::lock_guard<std::mutex> lock(table.mutex);
+  const auto found = table.names.find(name);
+  if (found == std::end(table.names)) {
+    return false;
+  }
+  symbol.entry = &*found;
+  return true;
+}
@@ -1,4 +1,7 @@
 #include "internal.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <stdexcept>
 
 auto string_from(const Token_type &token_type) -> std::string
 {
@@ -23,26 +26,54 @@ auto string_from(const Token_type &token_type) -> std::string
 
 struct Token::Impl final {
   std::string token_value = "";
+  Symbol token_symbol = Symbol();
+  std::size_t line = 0;
+  std::size_t column = 0;
   Token_type token_type = Token_type::nil;
   char padding[4] = {0};
 };
 
 Token::Token() : impl(std::make_shared<Impl>()) {}
 
-Token::Token(const Token_type token_type, std::string token_value) : Token()
+Token::Token(const Token_type token_type, std::string token_value, const std::size_t line, const std::size_t column)
+    : Token()
 {
+  if (token_type == Token_type::identifier) {
+    impl->token_symbol = Symbol(token_value);
+  }
   impl->token_value = std::move(token_value);
   impl->token_type = token_type;
+  impl->line = line;
+  impl->column = column;
 }
 
 const Token_type &Token::type() const noexcept { return impl->token_type; }
 
 const std::string &Token::value() const noexcept { return impl->token_value; }
 
-auto consume_from(Token_list &token_list) -> Token
+const Symbol &Token::symbol() const noexcept { return impl->token_symbol; }
+
+auto Token::line() const noexcept -> std::size_t { return impl->line; }
+
+auto Token::column() const noexcept -> std::size_t { return impl->column; }
+
+auto cursor_from(const Token_list &token_list) noexcept -> Token_cursor
+{
+  return Token_cursor{std::cbegin(token_list), std::cend(token_list)};
+}
+
+auto peek_from(const Token_cursor &token_cursor) -> const Token &
 {
-  auto token = token_list.front();
-  token_list.erase(std::begin(token_list));
+  if (token_cursor.current == token_cursor.end) {
+    throw std::runtime_error("Unexpected end of input.");
+  }
+  return *token_cursor.current;
+}
+
+auto consume_from(Token_cursor &token_cursor) -> const Token &
+{
+  const auto &token = peek_from(token_cursor);
+  ++token_cursor.current;
   return token;
 }
 
@@ -56,10 +87,21 @@ auto variant_from(const Token &token) -> Variant
   switch (token.type()) {
   case Token_type::nil:
     return Variant();
-  case Token_type::number:
-    return Variant(std::stod(token.value()));
+  case Token_type::number: {
+    // A number without a point is an integer, unless it does not fit one.
+    const auto &value = token.value();
+    if (value.find('.') == std::string::npos) {
+      errno = 0;
+      const auto integer = std::strtoll(value.c_str(), nullptr, 10);
+      if (errno != ERANGE) {
+        return Variant(static_cast<std::int64_t>(integer));
+      }
+    }
+    return Variant(std::stod(value));
+  }
   case Token_type::string:
-    return Variant(std::string(std::cbegin(token.value()) + 1, std::cend(token.value()) - 1));
+    // The literal is interned straight from the token text between its quotes.
+    return Variant(intern(token.value().data() + 1, token.value().size() - 2));
   case Token_type::boolean:
     return Variant(token.value() == "#t" ? true : false);
   case Token_type::identifier:
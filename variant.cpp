@@ -1,4 +1,9 @@
-#include "wlisp.hpp"
+#include "internal.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
 
 auto string_from(const Variant_type &variant_type) -> std::string
 {
@@ -7,6 +12,8 @@ auto string_from(const Variant_type &variant_type) -> std::string
     return "nil";
   case Variant_type::number:
     return "number";
+  case Variant_type::integer:
+    return "integer";
   case Variant_type::string:
     return "string";
   case Variant_type::boolean:
@@ -15,60 +22,181 @@ auto string_from(const Variant_type &variant_type) -> std::string
     return "list";
   case Variant_type::function:
     return "function";
+  case Variant_type::future:
+    return "future";
+  case Variant_type::array:
+    return "array";
   }
   return "unknown";
 }
 
-struct Variant::Impl final {
-  double number_value = 0.0;
-  std::string string_value = "";
-  Variant_list list_value = Variant_list();
-  Variant_function function_value = Variant_function();
-  Variant_type variant_type = Variant_type::nil;
-  bool boolean_value = false;
-  char padding[3] = {0};
+String_slice::String_slice(std::string string_value)
+    : String_slice(std::make_shared<const std::string>(std::move(string_value)))
+{
+}
+
+String_slice::String_slice(std::shared_ptr<const std::string> buffer_value)
+    : String_slice(buffer_value, 0, buffer_value ? buffer_value->size() : 0)
+{
+}
+
+String_slice::String_slice(std::shared_ptr<const std::string> buffer_value, const std::size_t offset,
+                           const std::size_t size_value)
+    : owner_value(buffer_value), data_value(nullptr), size_value(size_value), whole_value(nullptr)
+{
+  if (!buffer_value || offset > buffer_value->size() || size_value > buffer_value->size() - offset) {
+    throw std::runtime_error("String slice is out of range.");
+  }
+  data_value = buffer_value->data() + offset;
+  if (offset == 0 && size_value == buffer_value->size()) {
+    whole_value = buffer_value.get();
+  }
+}
+
+String_slice::String_slice(std::shared_ptr<const void> owner_value, const char *data_value,
+                           const std::size_t size_value)
+    : owner_value(std::move(owner_value)), data_value(data_value), size_value(size_value), whole_value(nullptr)
+{
+  if (!this->owner_value) {
+    throw std::runtime_error("String slice has no owner.");
+  }
+}
+
+auto String_slice::data() const noexcept -> const char * { return data_value; }
+
+auto String_slice::size() const noexcept -> std::size_t { return size_value; }
+
+auto String_slice::whole() const noexcept -> const std::string * { return whole_value; }
+
+auto String_slice::slice(const std::size_t offset, const std::size_t size) const -> String_slice
+{
+  if (offset > size_value || size > size_value - offset) {
+    throw std::runtime_error("String slice is out of range.");
+  }
+  auto sliced = String_slice(owner_value, data_value + offset, size);
+  if (offset == 0 && size == size_value) {
+    sliced.whole_value = whole_value;
+  }
+  return sliced;
+}
+
+auto string_from(const String_slice &slice) -> std::string { return std::string(slice.data(), slice.size()); }
+
+auto operator==(const String_slice &left, const String_slice &right) noexcept -> bool
+{
+  // Interned literals share their buffer, so equal ones are usually found without looking at the characters.
+  return left.size() == right.size() &&
+         (left.data() == right.data() || std::memcmp(left.data(), right.data(), left.size()) == 0);
+}
+
+auto operator!=(const String_slice &left, const String_slice &right) noexcept -> bool { return !(left == right); }
+
+namespace {
+
+/*
+ * The pool holds the buffers weakly, a string stays interned while some slice of it is alive. Buffers are found by
+ * the hash of their characters, and the ones that expired are swept out whenever the pool has doubled in size.
+ */
+struct Intern_pool final {
+  std::mutex mutex;
+  std::unordered_multimap<std::size_t, std::weak_ptr<const std::string>> strings;
+  std::size_t sweep_size = 64;
 };
 
-Variant::Variant() : impl(std::make_shared<Impl>()) {}
+auto intern_pool() -> Intern_pool &
+{
+  static Intern_pool pool;
+  return pool;
+}
+
+} // namespace
 
-Variant::Variant(const double number_value) : Variant()
+auto hash_characters(const char *characters, const std::size_t size) noexcept -> std::size_t
 {
-  impl->variant_type = Variant_type::number;
-  impl->number_value = number_value;
+  auto hash = std::uint64_t(0xcbf29ce484222325ull);
+  for (auto i = std::size_t(0); i != size; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(characters[i])) * 0x100000001b3ull;
+  }
+  return static_cast<std::size_t>(hash);
 }
 
-Variant::Variant(std::string string_value) : Variant()
+auto intern(const char *characters, const std::size_t size) -> String_slice
 {
-  impl->variant_type = Variant_type::string;
-  impl->string_value = std::move(string_value);
+  auto &pool = intern_pool();
+  const auto hash = hash_characters(characters, size);
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  const auto range = pool.strings.equal_range(hash);
+  for (auto i = range.first; i != range.second; ++i) {
+    auto buffer = i->second.lock();
+    if (buffer && buffer->size() == size && std::memcmp(buffer->data(), characters, size) == 0) {
+      return String_slice(std::move(buffer));
+    }
+  }
+  if (pool.strings.size() >= pool.sweep_size) {
+    for (auto i = std::begin(pool.strings); i != std::end(pool.strings);) {
+      i = i->second.expired() ? pool.strings.erase(i) : std::next(i);
+    }
+    pool.sweep_size = std::max(std::size_t(64), 2 * pool.strings.size());
+  }
+  auto buffer = std::make_shared<const std::string>(characters, size);
+  pool.strings.emplace(hash, buffer);
+  return String_slice(std::move(buffer));
 }
 
-Variant::Variant(const bool boolean_value) : Variant()
+/*
+ * Heap allocated values derive from the empty Impl, the shared_ptr control block created by make_shared destroys the
+ * concrete Value_impl so no virtual destructor is needed. The variant type tells which Value_impl is stored.
+ */
+struct Variant::Impl {};
+
+template <typename Value> struct Variant::Value_impl final : Variant::Impl {
+  explicit Value_impl(Value value_value) : value(std::move(value_value)) {}
+
+  Value value;
+};
+
+/*
+ * A string is kept as its slice. The copy is only made for a slice that is not a whole buffer, when string() asks
+ * for a std::string, and it is made once even when the Variant is shared between threads.
+ */
+template <> struct Variant::Value_impl<String_slice> final : Variant::Impl {
+  explicit Value_impl(String_slice value_value) : value(std::move(value_value)) {}
+
+  String_slice value;
+  mutable std::once_flag copied;
+  mutable std::string copy;
+};
+
+Variant::Variant(std::string string_value) : Variant(String_slice(std::move(string_value))) {}
+
+Variant::Variant(String_slice slice_value) : Variant()
 {
-  impl->variant_type = Variant_type::boolean;
-  impl->boolean_value = std::move(boolean_value);
+  variant_type = Variant_type::string;
+  impl = std::make_shared<const Value_impl<String_slice>>(std::move(slice_value));
 }
 
 Variant::Variant(Variant_list list_value) : Variant()
 {
-  impl->variant_type = Variant_type::list;
-  impl->list_value = std::move(list_value);
+  variant_type = Variant_type::list;
+  impl = std::make_shared<const Value_impl<Variant_list>>(std::move(list_value));
 }
 
 Variant::Variant(Variant_function function_value) : Variant()
 {
-  impl->variant_type = Variant_type::function;
-  impl->function_value = std::move(function_value);
+  variant_type = Variant_type::function;
+  impl = std::make_shared<const Value_impl<Variant_function>>(std::move(function_value));
 }
 
-auto Variant::type() const noexcept -> Variant_type { return impl->variant_type; }
+Variant::Variant(Future future_value) : Variant()
+{
+  variant_type = Variant_type::future;
+  impl = std::make_shared<const Value_impl<Future>>(std::move(future_value));
+}
 
-auto Variant::number() const -> double
+Variant::Variant(Number_array array_value) : Variant()
 {
-  if (type() != Variant_type::number) {
-    throw std::runtime_error("Variant is not of type number.");
-  }
-  return impl->number_value;
+  variant_type = Variant_type::array;
+  impl = std::make_shared<const Value_impl<Number_array>>(std::move(array_value));
 }
 
 const std::string &Variant::string() const
@@ -76,15 +204,20 @@ const std::string &Variant::string() const
   if (type() != Variant_type::string) {
     throw std::runtime_error("Variant is not of type string.");
   }
-  return impl->string_value;
+  const auto &value = static_cast<const Value_impl<String_slice> &>(*impl);
+  if (value.value.whole()) {
+    return *value.value.whole();
+  }
+  std::call_once(value.copied, [&value] { value.copy = string_from(value.value); });
+  return value.copy;
 }
 
-auto Variant::boolean() const -> bool
+const String_slice &Variant::slice() const
 {
-  if (type() != Variant_type::boolean) {
-    throw std::runtime_error("Variant is not of type boolean.");
+  if (type() != Variant_type::string) {
+    throw std::runtime_error("Variant is not of type string.");
   }
-  return impl->boolean_value;
+  return static_cast<const Value_impl<String_slice> &>(*impl).value;
 }
 
 const Variant_list &Variant::list() const
@@ -92,7 +225,7 @@ const Variant_list &Variant::list() const
   if (type() != Variant_type::list) {
     throw std::runtime_error("Variant is not of type list.");
   }
-  return impl->list_value;
+  return static_cast<const Value_impl<Variant_list> &>(*impl).value;
 }
 
 const Variant_function &Variant::function() const
@@ -100,7 +233,23 @@ const Variant_function &Variant::function() const
   if (type() != Variant_type::function) {
     throw std::runtime_error("Variant is not of type function.");
   }
-  return impl->function_value;
+  return static_cast<const Value_impl<Variant_function> &>(*impl).value;
+}
+
+const Future &Variant::future() const
+{
+  if (type() != Variant_type::future) {
+    throw std::runtime_error("Variant is not of type future.");
+  }
+  return static_cast<const Value_impl<Future> &>(*impl).value;
+}
+
+const Number_array &Variant::array() const
+{
+  if (type() != Variant_type::array) {
+    throw std::runtime_error("Variant is not of type array.");
+  }
+  return static_cast<const Value_impl<Number_array> &>(*impl).value;
 }
 
 auto string_from(const Variant &variant) -> std::string
@@ -110,14 +259,20 @@ auto string_from(const Variant &variant) -> std::string
     return "nil";
   case Variant_type::number:
     return std::to_string(variant.number());
+  case Variant_type::integer:
+    return std::to_string(variant.integer());
   case Variant_type::string:
-    return variant.string();
+    return string_from(variant.slice());
   case Variant_type::boolean:
     return variant.boolean() ? "true" : "false";
   case Variant_type::list:
     return "[list]";
   case Variant_type::function:
     return "[function]";
+  case Variant_type::future:
+    return "[future]";
+  case Variant_type::array:
+    return "[array]";
   }
   return "unknown";
 }
@@ -125,51 +280,138 @@ auto string_from(const Variant &variant) -> std::string
 auto operator==(const Variant &left, const Variant &right) -> bool
 {
   if (left.type() != right.type()) {
-    return false;
+    // An integer and a double compare as doubles do.
+    const auto numbers = (left.type() == Variant_type::number || left.type() == Variant_type::integer) &&
+                         (right.type() == Variant_type::number || right.type() == Variant_type::integer);
+    return numbers && std::abs(left.number() - right.number()) < 0.00001;
   }
   switch (left.type()) {
   case Variant_type::nil:
     return true;
   case Variant_type::number:
     return std::abs(left.number() - right.number()) < 0.00001;
+  case Variant_type::integer:
+    return left.integer() == right.integer();
   case Variant_type::boolean:
     return left.boolean() == right.boolean();
   case Variant_type::string:
-    return left.string() == right.string();
+    return left.slice() == right.slice();
   case Variant_type::list:
     return left.list() == right.list();
   case Variant_type::function:
     return true;
+  case Variant_type::future:
+    return left.future() == right.future();
+  case Variant_type::array:
+    return std::equal(std::cbegin(left.array()), std::cend(left.array()), std::cbegin(right.array()),
+                      std::cend(right.array()), [](const double left_number, const double right_number) {
+                        return std::abs(left_number - right_number) < 0.00001;
+                      });
   }
   return false;
 }
 
 auto operator!=(const Variant &left, const Variant &right) -> bool { return !(left == right); }
 
-auto operator+(const Variant &left, const Variant &right) -> Variant { return Variant(left.number() + right.number()); }
+auto integer_divide(const std::int64_t left, const std::int64_t right) -> Variant
+{
+  if (right == 0) {
+    throw std::runtime_error("Divide by zero.");
+  }
+  // INT64_MIN / -1 is the one whole quotient that does not fit (and the remainder would overflow as well).
+  if ((left == INT64_MIN && right == -1) || left % right != 0) {
+    return Variant(static_cast<double>(left) / static_cast<double>(right));
+  }
+  return Variant(left / right);
+}
+
+auto operator+(const Variant &left, const Variant &right) -> Variant
+{
+  if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+    return integer_add(left.integer(), right.integer());
+  }
+  if (left.type() == Variant_type::array || right.type() == Variant_type::array) {
+    return element_wise<Opcode::add>(left, right);
+  }
+  return Variant(left.number() + right.number());
+}
 
-auto operator-(const Variant &left, const Variant &right) -> Variant { return Variant(left.number() - right.number()); }
+auto operator-(const Variant &left, const Variant &right) -> Variant
+{
+  if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+    return integer_subtract(left.integer(), right.integer());
+  }
+  if (left.type() == Variant_type::array || right.type() == Variant_type::array) {
+    return element_wise<Opcode::subtract>(left, right);
+  }
+  return Variant(left.number() - right.number());
+}
 
-auto operator*(const Variant &left, const Variant &right) -> Variant { return Variant(left.number() * right.number()); }
+auto operator*(const Variant &left, const Variant &right) -> Variant
+{
+  if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+    return integer_multiply(left.integer(), right.integer());
+  }
+  if (left.type() == Variant_type::array || right.type() == Variant_type::array) {
+    return element_wise<Opcode::multiply>(left, right);
+  }
+  return Variant(left.number() * right.number());
+}
 
 auto operator/(const Variant &left, const Variant &right) -> Variant
 {
+  if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+    return integer_divide(left.integer(), right.integer());
+  }
+  if (left.type() == Variant_type::array || right.type() == Variant_type::array) {
+    return element_wise<Opcode::divide>(left, right);
+  }
   if (right.number() == 0.0) {
     throw std::runtime_error("Divide by zero.");
   }
   return Variant(left.number() / right.number());
 }
 
-auto operator<(const Variant &left, const Variant &right) -> Variant { return Variant(left.number() < right.number()); }
+auto operator<(const Variant &left, const Variant &right) -> Variant
+{
+  if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+    return Variant(left.integer() < right.integer());
+  }
+  if (left.type() == Variant_type::array || right.type() == Variant_type::array) {
+    return element_wise<Opcode::less>(left, right);
+  }
+  return Variant(left.number() < right.number());
+}
 
-auto operator>(const Variant &left, const Variant &right) -> Variant { return Variant(left.number() > right.number()); }
+auto operator>(const Variant &left, const Variant &right) -> Variant
+{
+  if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+    return Variant(left.integer() > right.integer());
+  }
+  if (left.type() == Variant_type::array || right.type() == Variant_type::array) {
+    return element_wise<Opcode::greater>(left, right);
+  }
+  return Variant(left.number() > right.number());
+}
 
 auto operator<=(const Variant &left, const Variant &right) -> Variant
 {
+  if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+    return Variant(left.integer() <= right.integer());
+  }
+  if (left.type() == Variant_type::array || right.type() == Variant_type::array) {
+    return element_wise<Opcode::less_equal>(left, right);
+  }
   return Variant(left.number() <= right.number());
 }
 
 auto operator>=(const Variant &left, const Variant &right) -> Variant
 {
+  if (left.type() == Variant_type::integer && right.type() == Variant_type::integer) {
+    return Variant(left.integer() >= right.integer());
+  }
+  if (left.type() == Variant_type::array || right.type() == Variant_type::array) {
+    return element_wise<Opcode::greater_equal>(left, right);
+  }
   return Variant(left.number() >= right.number());
 }
@@ -1,8 +1,139 @@
 #include "internal.hpp"
+#include <list>
+#include <mutex>
+#include <unordered_map>
 
-auto interpret(Environment environment, const std::string &input) -> Variant
+struct Program::Impl final {
+  AST ast = AST();
+  std::size_t folded_nodes = 0;
+  // The bytecode is compiled the first time the program runs on the bytecode engine.
+  mutable std::once_flag compiled;
+  mutable std::shared_ptr<const Prototype> prototype = nullptr;
+};
+
+Program::Program(const std::string &input) : Program(input, 1, 1) {}
+
+Program::Program(const std::string &input, const std::size_t line, const std::size_t column)
+{
+  auto program = std::make_shared<Impl>();
+  auto tokens = lexical_analysis(input, line, column);
+  auto folded = fold(resolve(parse_from(tokens)));
+  program->ast = std::move(folded.ast);
+  program->folded_nodes = folded.removed;
+  impl = std::move(program);
+}
+
+auto Program::execute(Environment environment, const Engine engine) const -> Variant
+{
+  if (engine == Engine::bytecode) {
+    std::call_once(impl->compiled, [this] { impl->prototype = ::compile(impl->ast); });
+    return run(*impl->prototype, environment, empty_variant_list);
+  }
+  return impl->ast->execute(environment, empty_variant_list);
+}
+
+auto Program::folded_nodes() const noexcept -> std::size_t { return impl->folded_nodes; }
+
+Program::Program(std::shared_ptr<const Impl> impl) noexcept : impl(std::move(impl)) {}
+
+auto Program::save(const std::string &path) const -> void { save_image(impl->ast, path); }
+
+auto Program::load(const std::string &path) -> Program
+{
+  auto program = std::make_shared<Impl>();
+  program->ast = load_image(path);
+  return Program(std::move(program));
+}
+
+auto compile(const std::string &input) -> Program { return Program(input); }
+
+namespace {
+
+/*!
+ * \brief The programs interpret has compiled, keyed by the hash of their source. The list is kept in order of use,
+ *        most recent first, and the map points into it.
+ */
+struct Program_cache final {
+  struct Entry final {
+    std::size_t hash;
+    std::string input;
+    Program program;
+  };
+
+  std::mutex mutex;
+  std::list<Entry> entries = std::list<Entry>();
+  std::unordered_map<std::size_t, std::list<Entry>::iterator> index =
+      std::unordered_map<std::size_t, std::list<Entry>::iterator>();
+  std::size_t capacity = 0;
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+};
+
+auto program_cache() -> Program_cache &
+{
+  static Program_cache cache;
+  return cache;
+}
+
+auto cached_program_from(const std::string &input) -> Program
+{
+  auto &cache = program_cache();
+  const auto hash = std::hash<std::string>()(input);
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (cache.capacity == 0) {
+      return compile(input);
+    }
+    const auto found = cache.index.find(hash);
+    // Two sources can share a hash, the entry is only used when the source matches too.
+    if (found != std::end(cache.index) && found->second->input == input) {
+      ++cache.hits;
+      cache.entries.splice(std::begin(cache.entries), cache.entries, found->second);
+      return found->second->program;
+    }
+    ++cache.misses;
+  }
+  // Compiled without holding the lock, so other threads are not kept waiting on it.
+  auto program = compile(input);
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  if (cache.capacity == 0) {
+    return program;
+  }
+  const auto found = cache.index.find(hash);
+  if (found != std::end(cache.index)) {
+    cache.entries.erase(found->second);
+    cache.index.erase(found);
+  }
+  cache.entries.push_front(Program_cache::Entry{hash, input, program});
+  cache.index.emplace(hash, std::begin(cache.entries));
+  while (cache.entries.size() > cache.capacity) {
+    cache.index.erase(cache.entries.back().hash);
+    cache.entries.pop_back();
+  }
+  return program;
+}
+
+} // namespace
+
+auto set_program_cache_capacity(const std::size_t capacity) -> void
+{
+  auto &cache = program_cache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.capacity = capacity;
+  while (cache.entries.size() > cache.capacity) {
+    cache.index.erase(cache.entries.back().hash);
+    cache.entries.pop_back();
+  }
+}
+
+auto program_cache_statistics() -> Program_cache_statistics
+{
+  auto &cache = program_cache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  return Program_cache_statistics{cache.hits, cache.misses, cache.entries.size(), cache.capacity};
+}
+
+auto interpret(Environment environment, const std::string &input, const Engine engine) -> Variant
 {
-  auto tokens = lexical_analysis(input);
-  auto parsed = parse_from(tokens);
-  return parsed->execute(environment, empty_variant_list);
+  return cached_program_from(input).execute(environment, engine);
 }
@@ -1,19 +1,91 @@
 #ifndef WLISP_HPP
 #define WLISP_HPP
 
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <functional>
+#include <iosfwd>
+#include <limits>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 class Environment_base;
+class Future_base;
 
 /*!
- * \brief Environment objects (stores key value pairs std::string and Variant).
+ * \brief An interned name. Every Symbol created from the same name refers to the same entry in
+ *        the global symbol table, so symbols are compared and hashed by that entry instead of
+ *        by their characters. Identifiers are interned when they are read by the lexer.
+ */
+class Symbol final {
+public:
+  Symbol();
+  explicit Symbol(const std::string &name);
+
+  ~Symbol() noexcept = default;
+  Symbol(const Symbol &) noexcept = default;
+  Symbol(Symbol &&) noexcept = default;
+  Symbol &operator=(const Symbol &) noexcept = default;
+  Symbol &operator=(Symbol &&) noexcept = default;
+
+  auto name() const noexcept -> const std::string &;
+
+private:
+  friend auto find_symbol(const std::string &name, Symbol &symbol) -> bool;
+
+  const std::string *entry;
+};
+
+/*!
+ * \brief Looks a name up in the symbol table without interning it, for lookups of names that may never have been
+ *        used: no variable can have a name that is not in the table.
+ * \return Whether the name is interned, in which case symbol is set to it.
+ */
+auto find_symbol(const std::string &name, Symbol &symbol) -> bool;
+
+inline auto Symbol::name() const noexcept -> const std::string & { return *entry; }
+
+inline auto operator==(const Symbol &left, const Symbol &right) noexcept -> bool
+{
+  return &left.name() == &right.name();
+}
+
+inline auto operator!=(const Symbol &left, const Symbol &right) noexcept -> bool { return !(left == right); }
+
+namespace std {
+template <> struct hash<Symbol> {
+  auto operator()(const Symbol &symbol) const noexcept -> std::size_t { return hash<const void *>()(&symbol.name()); }
+};
+} // namespace std
+
+/*!
+ * \brief Environment objects (stores key value pairs Symbol and Variant).
  *        Note: don't call this directly, use the create_environment methods.
  */
 using Environment = std::shared_ptr<Environment_base>;
 
-enum class Variant_type { nil, number, string, boolean, list, function };
+/*!
+ * \brief The names of the slots in an environment, i.e. the parameters of a lambda.
+ */
+using Slot_names = std::vector<Symbol>;
+
+/*!
+ * \brief A value being computed in the background (see Future_base).
+ */
+using Future = std::shared_ptr<Future_base>;
+
+/*!
+ * \brief The types of Variant. Numbers are either doubles (number) or 64 bit integers (integer), integers being what
+ *        literals without a decimal point give. Arithmetic on two integers gives an integer while the result fits
+ *        (and a division comes out whole), otherwise a double. Integers compare exactly, doubles (and a double with
+ *        an integer) are equal when they are within 0.00001 of each other.
+ */
+enum class Variant_type { nil, number, integer, string, boolean, list, function, future, array };
 
 /*!
  * \brief Returns a string representation of the Variant type.
@@ -26,23 +98,99 @@ class Variant;
 
 using Variant_list = std::vector<Variant>;
 
+/*!
+ * \brief The numbers of an array Variant, packed one after another. (array-from list) makes one from a list of
+ *        numbers. + - * / work element-wise on two arrays of the same length, or on an array and a number (which
+ *        takes part with every element). So do < > <= >=, giving 1 for the elements where they hold and 0 elsewhere,
+ *        while = compares whole arrays. (array-sum array), (array-min array), (array-max array) and
+ *        (array-dot array array) reduce them to a number.
+ */
+using Number_array = std::vector<double>;
+
 using Variant_function = std::function<Variant(Environment, const Variant_list &)>;
 
+/*!
+ * \brief The characters of a string Variant, a run of immutable memory that is shared rather than copied, kept alive
+ *        by its owner (a string buffer, or for instance the mapping of a program image). A string passed in as a
+ *        buffer, and any slice taken of it, reference the buffer's characters in place. Identical string literals
+ *        share one buffer.
+ */
+class String_slice final {
+public:
+  /*!
+   * \brief Makes a slice spanning the whole string, which becomes the buffer (it is moved, not copied).
+   */
+  explicit String_slice(std::string string_value);
+  /*!
+   * \brief Makes a slice spanning the whole buffer.
+   */
+  explicit String_slice(std::shared_ptr<const std::string> buffer_value);
+  /*!
+   * \brief Makes a slice of length characters of the buffer, starting at offset. Throws when the buffer is null or
+   *        the slice does not lie within it.
+   */
+  String_slice(std::shared_ptr<const std::string> buffer_value, const std::size_t offset,
+               const std::size_t size_value);
+  /*!
+   * \brief Makes a slice of size characters at data, which stay valid as long as the owner is alive. Throws when the
+   *        owner is null.
+   */
+  String_slice(std::shared_ptr<const void> owner_value, const char *data_value, const std::size_t size_value);
+
+  auto data() const noexcept -> const char *;
+  auto size() const noexcept -> std::size_t;
+  /*!
+   * \brief Returns the buffer when the slice spans the whole of it, otherwise nullptr.
+   */
+  auto whole() const noexcept -> const std::string *;
+  /*!
+   * \brief Returns the slice of size characters of this slice, starting at offset, with the same owner.
+   */
+  auto slice(const std::size_t offset, const std::size_t size) const -> String_slice;
+
+private:
+  std::shared_ptr<const void> owner_value;
+  const char *data_value;
+  std::size_t size_value;
+  const std::string *whole_value;
+};
+
+auto string_from(const String_slice &slice) -> std::string;
+
+auto operator==(const String_slice &left, const String_slice &right) noexcept -> bool;
+auto operator!=(const String_slice &left, const String_slice &right) noexcept -> bool;
+
 /*!
  * \brief The Variant class is used to communicate between the interpreter and
  *        the developer, i.e. Variants are passed to the lisp code and are also
  *        returned from the lisp code. Operations for equivalence are universal
  *        to all types in the Variant. Other operations are specific to the number
  *        variant.
+ *        Numbers, integers, booleans and nil are stored inline, only strings, lists,
+ *        functions, futures and arrays are allocated (and shared between copies).
  */
 class Variant final {
 public:
-  Variant();
-  explicit Variant(const double number_value);
+  Variant() noexcept;
+  explicit Variant(const double number_value) noexcept;
+  explicit Variant(const std::int64_t integer_value) noexcept;
+  /*!
+   * \brief Makes an integer of any other integral type, so Variant(1) is not ambiguous.
+   */
+  template <typename Integral,
+            std::enable_if_t<std::is_integral<Integral>::value && !std::is_same<Integral, bool>::value &&
+                                 !std::is_same<Integral, std::int64_t>::value,
+                             int> = 0>
+  explicit Variant(const Integral integer_value) noexcept : Variant(static_cast<std::int64_t>(integer_value))
+  {
+  }
   explicit Variant(std::string string_value);
-  explicit Variant(const bool boolean_value);
+  explicit Variant(String_slice slice_value);
+  explicit Variant(const bool boolean_value) noexcept;
   explicit Variant(Variant_list list_value);
   explicit Variant(Variant_function function_value);
+  explicit Variant(Future future_value);
+  explicit Variant(Number_array array_value);
 
   ~Variant() noexcept = default;
   Variant(const Variant &) = default;
@@ -51,17 +199,81 @@ public:
   Variant &operator=(Variant &&) noexcept = default;
 
   auto type() const noexcept -> Variant_type;
+  /*!
+   * \brief Returns the number, or the integer converted to a double.
+   */
   auto number() const -> double;
+  auto integer() const -> std::int64_t;
+  /*!
+   * \brief Returns the string. A slice that is not a whole buffer is copied out the first time.
+   */
   const std::string &string() const;
+  const String_slice &slice() const;
   auto boolean() const -> bool;
   const Variant_list &list() const;
   const Variant_function &function() const;
+  const Future &future() const;
+  const Number_array &array() const;
 
 private:
   struct Impl;
-  std::shared_ptr<Impl> impl;
+  template <typename Value> struct Value_impl;
+
+  Variant_type variant_type;
+  union {
+    double number_value;
+    std::int64_t integer_value;
+    bool boolean_value;
+  };
+  std::shared_ptr<const Impl> impl;
 };
 
+inline Variant::Variant() noexcept : variant_type(Variant_type::nil), number_value(0.0) {}
+
+inline Variant::Variant(const double number_value) noexcept
+    : variant_type(Variant_type::number), number_value(number_value)
+{
+}
+
+inline Variant::Variant(const std::int64_t integer_value) noexcept
+    : variant_type(Variant_type::integer), integer_value(integer_value)
+{
+}
+
+inline Variant::Variant(const bool boolean_value) noexcept
+    : variant_type(Variant_type::boolean), boolean_value(boolean_value)
+{
+}
+
+inline auto Variant::type() const noexcept -> Variant_type { return variant_type; }
+
+inline auto Variant::number() const -> double
+{
+  if (variant_type == Variant_type::integer) {
+    return static_cast<double>(integer_value);
+  }
+  if (variant_type != Variant_type::number) {
+    throw std::runtime_error("Variant is not of type number.");
+  }
+  return number_value;
+}
+
+inline auto Variant::integer() const -> std::int64_t
+{
+  if (variant_type != Variant_type::integer) {
+    throw std::runtime_error("Variant is not of type integer.");
+  }
+  return integer_value;
+}
+
+inline auto Variant::boolean() const -> bool
+{
+  if (variant_type != Variant_type::boolean) {
+    throw std::runtime_error("Variant is not of type boolean.");
+  }
+  return boolean_value;
+}
+
 /*!
  * \brief A general empty variant list to use (so you don't have to allocate every time).
  */
@@ -85,6 +297,134 @@ auto operator>(const Variant &left, const Variant &right) -> Variant;
 auto operator<=(const Variant &left, const Variant &right) -> Variant;
 auto operator>=(const Variant &left, const Variant &right) -> Variant;
 
+/*!
+ * \brief The state of a computation that runs in the background and is joined later, made by create_future or by the
+ *        (future expression) form. The computation is scheduled on the future executor when the future is
+ *        made. touch returns its value once it is ready: if the executor has not started the computation yet it runs
+ *        on the thread touching it instead, if it is running elsewhere that thread runs waiting tasks of the thread
+ *        pool (or sleeps) until it is done. An exception thrown by the computation is rethrown by every touch.
+ */
+class Future_base final {
+public:
+  explicit Future_base(std::function<Variant()> computation);
+
+  Future_base() = delete;
+  ~Future_base() noexcept = default;
+  Future_base(const Future_base &) noexcept = default;
+  Future_base(Future_base &&) noexcept = default;
+  Future_base &operator=(const Future_base &) noexcept = default;
+  Future_base &operator=(Future_base &&) noexcept = default;
+
+  /*!
+   * \brief Runs the computation on the calling thread, unless it was already started (the executor calls this).
+   */
+  auto run() const noexcept -> void;
+  auto ready() const noexcept -> bool;
+  auto touch() const -> Variant;
+
+private:
+  struct Impl;
+  std::shared_ptr<Impl> impl;
+};
+
+/*!
+ * \brief Runs the tasks it is given at some point, on any thread. Futures are scheduled on one.
+ */
+using Executor = std::function<void(std::function<void()>)>;
+
+/*!
+ * \brief Create a future running the given computation, scheduled on the future executor.
+ * \param computation The computation, which runs once.
+ * \return The future.
+ */
+auto create_future(std::function<Variant()> computation) -> Future;
+
+/*!
+ * \brief Set the executor futures are scheduled on from now on. The default (restored by passing nullptr) is the
+ *        thread pool of the parallel forms, with a pool size of 1 a future runs when it is first touched.
+ *        A (future expression) runs the expression as the body of a lambda without parameters, while the code that
+ *        made it goes on. It sees the variables of that code as they were when the future was made (it runs on a
+ *        copy of them) except those in concurrent environments (see Note 6 of Environment_base), which it shares.
+ *        The built-in function (touch value) returns the value of a future (see Future_base), any other value is
+ *        returned as it is.
+ * \param executor The executor.
+ */
+auto set_future_executor(Executor executor) -> void;
+
+/*!
+ * \brief Where (print-line value) writes its lines. An environment writes to the sink set on it, or else to that of
+ *        the nearest enclosing environment that has one, or else to the standard output (see standard_output).
+ *        Interpreters on several threads can share a sink, so write and flush must be safe to call concurrently, and
+ *        each line written should come out whole.
+ */
+class Output_sink {
+public:
+  Output_sink() noexcept = default;
+  virtual ~Output_sink() noexcept;
+  Output_sink(const Output_sink &) = delete;
+  Output_sink(Output_sink &&) = delete;
+  Output_sink &operator=(const Output_sink &) = delete;
+  Output_sink &operator=(Output_sink &&) = delete;
+
+  /*!
+   * \brief Takes one line, without its line break.
+   */
+  virtual auto write(const std::string &line) -> void = 0;
+
+  /*!
+   * \brief Writes out anything the sink is holding back. Does nothing by default.
+   */
+  virtual auto flush() -> void;
+};
+
+using Output = std::shared_ptr<Output_sink>;
+
+/*!
+ * \brief When a Buffered_output writes its lines to its stream.
+ *        every_line: after every line, as print-line always did. The default.
+ *        when_full: once the lines held reach the batch size, and when the sink is flushed or destroyed. Meant for
+ *                   bulk output, lines held back are lost if the program aborts.
+ */
+enum class Flush_policy { every_line, when_full };
+
+struct Output_options final {
+  std::size_t batch_size;
+  Flush_policy flush_policy;
+};
+
+/*!
+ * \brief An Output_sink collecting lines for an std::ostream, which it writes (and flushes) a batch at a time. Lines
+ *        are collected under a lock, so lines from several threads never run into each other.
+ */
+class Buffered_output final : public Output_sink {
+public:
+  explicit Buffered_output(std::ostream &stream,
+                           const Output_options &options = Output_options{8192, Flush_policy::every_line});
+  ~Buffered_output() noexcept;
+
+  auto write(const std::string &line) -> void;
+  auto flush() -> void;
+
+private:
+  struct Impl;
+  std::shared_ptr<Impl> impl;
+};
+
+/*!
+ * \brief Returns the sink of environments that have none of their own. It is a Buffered_output on std::cout with the
+ *        default options (a line is written as soon as it is printed) unless replaced. A replacement that holds lines
+ *        back is flushed when it is replaced and when the program exits normally, not when it aborts.
+ * \return The sink.
+ */
+auto standard_output() -> Output;
+
+/*!
+ * \brief Replace the sink of environments that have none of their own, the previous one is flushed. The default is
+ *        restored by passing nullptr.
+ * \param sink The sink.
+ */
+auto set_standard_output(Output sink) -> void;
+
 /*!
  * \brief The Environment_base class is the base class for the Environment object. It
  *        contains all current variables in the environment. The local scope is a map
@@ -94,11 +434,31 @@ auto operator>=(const Variant &left, const Variant &right) -> Variant;
  *        then link the parent afterwards.
  *        Note 2: Do not use this class directly, use the Environment object through the
  *        create_environment methods.
+ *        Note 3: Besides the map, an environment can hold a fixed number of slots (the
+ *        arguments of a lambda call). Slots are named for the lookup methods, but the
+ *        interpreter reads them by index when the name was resolved at parse time.
+ *        Note 4: rebind replaces the slots when a lambda makes a tail call, the environment
+ *        of the caller is reused for the callee. Previous slot values that the new names
+ *        do not shadow are kept in the map, so the callee sees the same variables it would
+ *        see through a new environment linked to the caller's.
+ *        Note 5: reset empties the environment for reuse by another call, linked to the
+ *        given parent and with a nil slot for each of the given names. The interpreter
+ *        recycles the environments of finished calls that nothing else refers to.
+ *        Note 6: An environment made by create_concurrent_environment can be shared between
+ *        threads, every method locks it (readers on a lock of their own, so they do not
+ *        contend with each other). A reference returned by get stays valid, but another
+ *        thread can set the variable while it is read through it, lookup copies the value
+ *        under the lock instead. Other environments are not locked and belong to one thread
+ *        at a time, the usual setup is a child environment per thread linked to a shared
+ *        concurrent one. Linking (parent) is not synchronized.
+ *        Note 7: output sets the sink print-line writes to in this environment and the ones
+ *        linked below it (see Output_sink), output() returns the one in effect.
  */
 class Environment_base final {
 public:
   Environment_base() noexcept;
   Environment_base(Environment parent) noexcept;
+  Environment_base(Environment parent, std::shared_ptr<const Slot_names> slot_names, Variant_list slots) noexcept;
 
   ~Environment_base() noexcept = default;
   Environment_base(const Environment_base &) noexcept = default;
@@ -107,35 +467,449 @@ public:
   Environment_base &operator=(Environment_base &&) noexcept = default;
 
   auto parent(Environment parent_value) noexcept -> void;
-  auto has(const std::string &key) const noexcept -> bool;
+  auto has(const Symbol &key) const -> bool;
+  auto has(const std::string &key) const -> bool;
+  auto lookup(const Symbol &key, Variant &value) const -> bool;
+  const Variant &get(const Symbol &key) const;
   const Variant &get(const std::string &key) const;
-  auto set(std::string key, Variant value) noexcept -> void;
-  auto to_string() const noexcept -> std::string;
+  auto set(const Symbol &key, Variant value) -> void;
+  auto set(const std::string &key, Variant value) -> void;
+  auto slot(const std::size_t index) const noexcept -> const Variant &;
+  auto slot(const std::size_t index, Variant value) noexcept -> void;
+  auto rebind(std::shared_ptr<const Slot_names> slot_names, const Variant_list &slots) -> void;
+  auto reset(Environment parent, std::shared_ptr<const Slot_names> slot_names) -> void;
+  auto to_string() const -> std::string;
+  auto output(Output sink) -> void;
+  auto output() const -> Output;
 
 private:
   struct Impl;
+  struct Locks;
   std::shared_ptr<Impl> impl;
+
+  auto find_local(const Symbol &key) const noexcept -> Variant *;
+
+  friend auto create_concurrent_environment(Environment parent) -> Environment;
+  friend auto snapshot_environment(const Environment &environment) -> Environment;
 };
 
 /*!
- * \brief Create a new environment linking to the given parent.
- * \param parent The parent environment to link to.
+ * \brief Create a new environment linking to the given parent. An environment without a parent has the built-in
+ *        functions bound in it: (pmap function list), see set_thread_pool_size, and (touch value), see
+ *        set_future_executor.
+ * \param parent The parent environment to link to, or nullptr for none.
  * \return The new environment.
  */
 auto create_environment(Environment parent) -> Environment;
 
 /*!
- * \brief Create a new environment with no parent.
+ * \brief Create a new environment with no parent, with the built-in functions bound in it.
  * \return The new environment.
  */
 auto create_environment() -> Environment;
 
+/*!
+ * \brief Create a new environment linking to the given parent, whose variables are stored in slots.
+ * \param parent The parent environment to link to.
+ * \param slot_names The names of the slots (slot_names[i] names slots[i]).
+ * \param slots The initial values of the slots.
+ * \return The new environment.
+ */
+auto create_environment(Environment parent, std::shared_ptr<const Slot_names> slot_names, Variant_list slots)
+    -> Environment;
+
+/*!
+ * \brief Create a new environment that can be shared between threads (see Note 6 of Environment_base).
+ * \param parent The parent environment to link to, or nullptr for none.
+ * \return The new environment.
+ */
+auto create_concurrent_environment(Environment parent = nullptr) -> Environment;
+
+/*!
+ * \brief Converts the arguments of a function registered with register_function from the Variants they are passed as,
+ *        for each type such a function can take (by value or const reference): any arithmetic type but bool takes a
+ *        number or an integer whose value the type can hold (an integral type only one without a fraction), bool a
+ *        boolean, std::string a string, String_slice a string without copying it out,
+ *        Variant_list a list, Number_array an array and Variant anything. The conversion throws when the Variant is of
+ *        another type.
+ */
+template <typename Type, typename = void> struct Native_argument;
+
+template <typename Type>
+struct Native_argument<Type, std::enable_if_t<std::is_integral<Type>::value && !std::is_same<Type, bool>::value>>
+    final {
+  static auto from(const Variant &variant) -> Type
+  {
+    // An integer goes to the parameter without passing through a double, which would round it.
+    if (variant.type() == Variant_type::integer) {
+      const auto integer = variant.integer();
+      const auto highest = static_cast<std::uint64_t>(std::numeric_limits<Type>::max());
+      if (integer < 0 ? integer < static_cast<std::int64_t>(std::numeric_limits<Type>::min())
+                      : static_cast<std::uint64_t>(integer) > highest) {
+        throw std::runtime_error("Variant is out of range of the parameter.");
+      }
+      return static_cast<Type>(integer);
+    }
+    const auto number = variant.number();
+    if (number != std::trunc(number)) {
+      throw std::runtime_error("Variant is not of type integer.");
+    }
+    // The bounds are powers of two, so both are exact as doubles: the lowest value and one past the highest.
+    const auto lowest = static_cast<double>(std::numeric_limits<Type>::min());
+    const auto past_highest = static_cast<double>(std::numeric_limits<Type>::max() / 2 + 1) * 2.0;
+    if (!(number >= lowest && number < past_highest)) {
+      throw std::runtime_error("Variant is out of range of the parameter.");
+    }
+    return static_cast<Type>(number);
+  }
+};
+
+template <typename Type> struct Native_argument<Type, std::enable_if_t<std::is_floating_point<Type>::value>> final {
+  static auto from(const Variant &variant) -> Type
+  {
+    const auto number = variant.number();
+    if (std::isfinite(number) && std::fabs(number) > static_cast<double>(std::numeric_limits<Type>::max())) {
+      throw std::runtime_error("Variant is out of range of the parameter.");
+    }
+    return static_cast<Type>(number);
+  }
+};
+
+template <> struct Native_argument<bool> final {
+  static auto from(const Variant &variant) -> bool { return variant.boolean(); }
+};
+
+template <> struct Native_argument<std::string> final {
+  static auto from(const Variant &variant) -> const std::string & { return variant.string(); }
+};
+
+template <> struct Native_argument<String_slice> final {
+  static auto from(const Variant &variant) -> const String_slice & { return variant.slice(); }
+};
+
+template <> struct Native_argument<Variant_list> final {
+  static auto from(const Variant &variant) -> const Variant_list & { return variant.list(); }
+};
+
+template <> struct Native_argument<Number_array> final {
+  static auto from(const Variant &variant) -> const Number_array & { return variant.array(); }
+};
+
+template <> struct Native_argument<Variant> final {
+  static auto from(const Variant &variant) -> const Variant & { return variant; }
+};
+
+/*!
+ * \brief Converts the result of a registered function to a Variant, for the same types as Native_argument and
+ *        C strings. Integral types give an integer, floating point types a number and void gives nil.
+ */
+template <typename Type, typename = void> struct Native_result final {
+  static auto from(Type value) -> Variant { return Variant(std::move(value)); }
+};
+
+template <typename Type>
+struct Native_result<Type, std::enable_if_t<std::is_floating_point<Type>::value>> final {
+  static auto from(const Type value) -> Variant { return Variant(static_cast<double>(value)); }
+};
+
+template <typename Type>
+struct Native_result<Type, std::enable_if_t<std::is_integral<Type>::value && !std::is_same<Type, bool>::value>>
+    final {
+  static auto from(const Type value) -> Variant { return Variant(static_cast<std::int64_t>(value)); }
+};
+
+template <> struct Native_result<const char *> final {
+  static auto from(const char *value) -> Variant { return Variant(std::string(value)); }
+};
+
+/*!
+ * \brief The Variant_function a registered function is called through. It checks the number of arguments and converts
+ *        them with code generated for its parameter types, then calls the function directly.
+ */
+template <typename Function, typename Result, typename... Arguments> struct Native_function final {
+  Function function;
+
+  auto operator()(Environment, const Variant_list &arguments) const -> Variant
+  {
+    if (arguments.size() != sizeof...(Arguments)) {
+      throw std::runtime_error("Invalid number of arguments.");
+    }
+    return call(arguments, std::index_sequence_for<Arguments...>(), std::is_void<Result>());
+  }
+
+private:
+  template <std::size_t... indices>
+  auto call(const Variant_list &arguments, std::index_sequence<indices...>, std::false_type) const -> Variant
+  {
+    static_cast<void>(arguments);
+    return Native_result<std::decay_t<Result>>::from(
+        function(Native_argument<std::decay_t<Arguments>>::from(arguments[indices])...));
+  }
+
+  template <std::size_t... indices>
+  auto call(const Variant_list &arguments, std::index_sequence<indices...>, std::true_type) const -> Variant
+  {
+    static_cast<void>(arguments);
+    function(Native_argument<std::decay_t<Arguments>>::from(arguments[indices])...);
+    return Variant();
+  }
+};
+
+/*!
+ * \brief The result and parameter types of a function pointer, or of the call operator of a lambda or function object.
+ */
+template <typename Function> struct Native_signature : Native_signature<decltype(&Function::operator())> {
+};
+
+template <typename Result, typename... Arguments> struct Native_signature<Result (*)(Arguments...)> {
+  template <typename Function> using Native = Native_function<Function, Result, Arguments...>;
+};
+
+template <typename Class, typename Result, typename... Arguments>
+struct Native_signature<Result (Class::*)(Arguments...) const> {
+  template <typename Function> using Native = Native_function<Function, Result, Arguments...>;
+};
+
+/*!
+ * \brief Set a variable of the given environment to a C++ function, callable from lisp code as any other. The number
+ *        and types of its parameters are taken from its signature, so calls with another number of arguments or
+ *        arguments of other types (see Native_argument) throw, and no unpacking has to be written by hand.
+ *        A function object (a lambda, say) is held inside the Variant_function, which keeps small ones without an
+ *        allocation of their own. Its call operator must be const, as it may be called from several threads.
+ * \param environment The environment to set the variable in.
+ * \param name The name of the variable.
+ * \param function A function pointer, lambda or function object with a single, non template call operator.
+ */
+template <typename Function>
+auto register_function(Environment environment, const std::string &name, Function function) -> void
+{
+  using Native = typename Native_signature<Function>::template Native<Function>;
+  environment->set(name, Variant(Variant_function(Native{std::move(function)})));
+}
+
+/*!
+ * \brief The ways the interpreter can execute parsed code.
+ *        tree_walk: evaluates the syntax tree directly.
+ *        bytecode: compiles the syntax tree to bytecode first and runs it on a stack machine.
+ */
+enum class Engine { tree_walk, bytecode };
+
+/*!
+ * \brief Lisp code that has been lexed, parsed and compiled once, ready to be executed any number of times against
+ *        any environment. Copies share the compiled code, which is never modified, so a program can be executed
+ *        from several threads at once.
+ */
+class Program final {
+public:
+  explicit Program(const std::string &input);
+
+  /*!
+   * \brief Compiles input that starts at the given line and column of a larger source, so the positions recorded
+   *        for its tokens (and the names of its lambdas) are those in that source.
+   */
+  Program(const std::string &input, const std::size_t line, const std::size_t column);
+
+  Program() = delete;
+  ~Program() noexcept = default;
+  Program(const Program &) noexcept = default;
+  Program(Program &&) noexcept = default;
+  Program &operator=(const Program &) noexcept = default;
+  Program &operator=(Program &&) noexcept = default;
+
+  auto execute(Environment environment, const Engine engine = Engine::tree_walk) const -> Variant;
+
+  /*!
+   * \brief Returns how many nodes constant folding removed from the tree when the program was compiled from source.
+   *        A loaded program was folded before it was saved and returns 0.
+   */
+  auto folded_nodes() const noexcept -> std::size_t;
+
+  /*!
+   * \brief Writes the program, as it is after parsing and the passes over the tree, to a binary file that load reads
+   *        back without doing any of that again. The file is versioned and bound to the byte order it was written
+   *        with, load refuses any other.
+   * \param path The file to write.
+   */
+  auto save(const std::string &path) const -> void;
+
+  /*!
+   * \brief Reads a program written by save. The file is mapped into memory and the program built straight from it.
+   * \param path The file to read.
+   * \return The program, which runs as the one saved did.
+   */
+  static auto load(const std::string &path) -> Program;
+
+private:
+  struct Impl;
+  std::shared_ptr<const Impl> impl;
+
+  explicit Program(std::shared_ptr<const Impl> impl) noexcept;
+};
+
+/*!
+ * \brief Compile the given string for repeated execution.
+ * \param input The lisp code to compile.
+ * \return The compiled program.
+ */
+auto compile(const std::string &input) -> Program;
+
+/*!
+ * \brief The counters of the program cache used by interpret.
+ */
+struct Program_cache_statistics final {
+  std::size_t hits;
+  std::size_t misses;
+  std::size_t size;
+  std::size_t capacity;
+};
+
+/*!
+ * \brief Set how many programs interpret keeps, the least recently used are dropped first. The cache is disabled
+ *        (and emptied) with a capacity of 0, which is the default.
+ * \param capacity The maximum number of programs to keep.
+ */
+auto set_program_cache_capacity(const std::size_t capacity) -> void;
+
+/*!
+ * \brief Returns the counters of the program cache.
+ * \return The counters, hits and misses are only counted while the cache is enabled.
+ */
+auto program_cache_statistics() -> Program_cache_statistics;
+
 /*!
  * \brief Interpret the given string using the given environment.
  * \param environment The environment to use when interpreting.
  * \param input The lisp code to interpret.
+ * \param engine The engine executing the code (both give the same results).
  * \return A Variant result from the interpretation.
+ * \note When the program cache is enabled, input seen before is not compiled again.
+ */
+auto interpret(Environment environment, const std::string &input, const Engine engine = Engine::tree_walk) -> Variant;
+
+/*!
+ * \brief Interprets lisp code that arrives in pieces, from a pipe or a file read a chunk at a time. Every top level
+ *        form is executed as soon as it is complete, so only the form being read is held in memory however long the
+ *        input runs. A chunk can end anywhere, in the middle of a string or a number included.
+ *
+ * Note 1: A form in parentheses or a string is complete once it is closed. Any other form (a number, a name) is only
+ *         complete once something that cannot be part of it follows, or the input ends.
+ * Note 2: When a form throws, the forms after it in the chunk are kept and run by the next feed or finish.
+ */
+class Stream_interpreter final {
+public:
+  explicit Stream_interpreter(Environment environment, const Engine engine = Engine::tree_walk);
+
+  Stream_interpreter() = delete;
+  ~Stream_interpreter() noexcept = default;
+  Stream_interpreter(const Stream_interpreter &) noexcept = default;
+  Stream_interpreter(Stream_interpreter &&) noexcept = default;
+  Stream_interpreter &operator=(const Stream_interpreter &) noexcept = default;
+  Stream_interpreter &operator=(Stream_interpreter &&) noexcept = default;
+
+  /*!
+   * \brief Reads the next piece of the input and executes the forms it completes.
+   * \return Their results, in order.
+   */
+  auto feed(const std::string &chunk) -> Variant_list;
+
+  /*!
+   * \brief Ends the input, executing the form it completes. A form still open is reported as the same error
+   *        interpret gives for it.
+   * \return Its result, or nothing when no form was left.
+   */
+  auto finish() -> Variant_list;
+
+private:
+  struct Impl;
+  std::shared_ptr<Impl> impl;
+};
+
+/*!
+ * \brief Interpret the lisp code read from the given stream form by form (see Stream_interpreter). Reading never
+ *        waits for more than the stream has buffered once a character is there, so forms from a pipe are executed
+ *        as they arrive.
+ * \param environment The environment to use when interpreting.
+ * \param input The stream to read up to its end.
+ * \param engine The engine executing the code.
+ * \return The result of the last form, nil when there was none.
+ */
+auto interpret(Environment environment, std::istream &input, const Engine engine = Engine::tree_walk) -> Variant;
+
+/*!
+ * \brief The order in which a memo-lambda drops cached results once it holds as many as its capacity.
+ *        least_recently_used: drops the result that was returned longest ago.
+ *        first_in_first_out: drops the result that was cached first.
+ */
+enum class Memo_eviction { least_recently_used, first_in_first_out };
+
+/*!
+ * \brief How a memo-lambda caches results. A capacity of 0 disables caching.
+ */
+struct Memo_options final {
+  std::size_t capacity;
+  Memo_eviction eviction;
+};
+
+/*!
+ * \brief The counters of the cache of a memo-lambda.
+ */
+struct Memo_statistics final {
+  std::size_t hits;
+  std::size_t misses;
+  std::size_t evictions;
+  std::size_t size;
+  std::size_t capacity;
+};
+
+/*!
+ * \brief Set the options of the memo-lambdas evaluated from now on (the default is a capacity of 1024 with least
+ *        recently used eviction). A (memo-lambda (parameters) body) is a lambda that caches its result for each
+ *        distinct list of arguments, compared by value. Calls with a function among their arguments are not cached.
+ *        The body is not run again for cached arguments, so it should depend on nothing but its parameters.
+ * \param options The options.
+ */
+auto set_memo_options(const Memo_options &options) -> void;
+
+/*!
+ * \brief Returns the counters of a memo-lambda's cache.
+ * \param function The function a memo-lambda evaluated to.
+ * \return The counters.
+ */
+auto memo_statistics(const Variant &function) -> Memo_statistics;
+
+/*!
+ * \brief Set the number of threads running the forms of a (parallel-begin forms...) and the calls of a
+ *        (pmap function list), counting the thread that waits for them, which runs them as well (the default is one
+ *        per core). With a size of 1 they all run on the calling thread, one after another.
+ *        Both return the list of results in order, and when any of them throws, the exception of the first (in
+ *        order) is rethrown once they have all finished. Each form of a parallel-begin runs as the body of a lambda
+ *        without parameters, in an environment of its own linked to the current one, so the variables it sets
+ *        first are its own. Variables they share are read concurrently, and must only be set by them when they
+ *        are in a concurrent environment (see Note 6 of Environment_base).
+ * \param size The number of threads, 0 is taken as 1.
+ */
+auto set_thread_pool_size(const std::size_t size) -> void;
+
+/*!
+ * \brief Returns the number of threads running parallel forms, as set by set_thread_pool_size.
+ * \return The number of threads.
+ */
+auto thread_pool_size() -> std::size_t;
+
+/*!
+ * \brief Start the sampling profiler. While it runs, every thread keeps a stack of the lambdas it is calling, named
+ *        after the variable they were set to (otherwise lambda@line:column of their source), and after every
+ *        interval a timer thread records the stack of each thread inside a lambda as a sample. Intervals the timer
+ *        missed (when it was not scheduled in time) are counted in the next sample.
+ * \param interval The time between samples.
+ */
+auto start_profiler(const std::chrono::microseconds interval = std::chrono::milliseconds(1)) -> void;
+
+/*!
+ * \brief Stop the sampling profiler.
+ * \return The samples in folded stack format, a "outer;inner count" line per distinct stack, as read by the flame
+ *         graph tools.
  */
-auto interpret(Environment environment, const std::string &input) -> Variant;
+auto stop_profiler() -> std::string;
 
 #endif // WLISP_HPP